@@ -0,0 +1,457 @@
+#include <dirent.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "corpus.h"
+#include "solver.h"
+#include "types.h"
+
+
+// A corpus that's being solved. It stays open until the last board
+// that points into it is done.
+typedef struct {
+    corpus_t corpus;
+    // The file name, for the IDs. NULL when solving a single corpus.
+    char *name;
+    uint32_t users;
+    uint8_t exhausted;
+} openCorpus_t;
+
+
+typedef struct {
+    batchOptions_t *options;
+
+    // Everything up to the output stuff is protected by inputLock.
+    pthread_mutex_t inputLock;
+    char *directory;
+    char **files;
+    uint32_t fileCount;
+    uint32_t nextFile;
+    openCorpus_t *current;
+    uint32_t nextIndex;
+
+    // Everything below is protected by outputLock.
+    pthread_mutex_t outputLock;
+
+    // Lines waiting for the lines before them (ORDER_INPUT only).
+    char **pending;
+    uint32_t pendingCapacity;
+    uint32_t nextOutput;
+
+    double *latencies;
+    uint32_t latencyCount;
+    uint32_t latencyCapacity;
+    uint32_t solved;
+} batch_t;
+
+
+typedef struct {
+    uint32_t index;
+    openCorpus_t *source;
+    puzzleView_t puzzle;
+    // Whether it's the only board in its file.
+    uint8_t single;
+} job_t;
+
+
+static void *batchWorker(void *arg);
+static int takeJob(batch_t *batch, job_t *job);
+static void finishJob(batch_t *batch, job_t *job);
+static openCorpus_t *openNextCorpus(batch_t *batch);
+static void report(batch_t *batch, uint32_t index, char *line, double ms, uint8_t solved);
+static void writeId(FILE *out, job_t *job);
+static int listFiles(batch_t *batch, const char *directory);
+static int compareStrings(const void *a, const void *b);
+static int compareDoubles(const void *a, const void *b);
+static double percentile(double *sorted, uint32_t count, double fraction);
+
+
+int solveBatch(const char *path, batchOptions_t *options) {
+    batch_t batch = {0};
+    batch.options = options;
+    pthread_mutex_init(&batch.inputLock, NULL);
+    pthread_mutex_init(&batch.outputLock, NULL);
+
+    struct stat info;
+    if (stat(path, &info)) {
+        fprintf(stderr, "%s not found.\n", path);
+        return -1;
+    }
+
+    if (S_ISDIR(info.st_mode)) {
+        if (listFiles(&batch, path)) return -1;
+    }
+    else {
+        // Just the one corpus, and no file names in the IDs.
+        batch.files = malloc(sizeof(char*));
+        batch.files[0] = strdup(path);
+        batch.fileCount = 1;
+    }
+
+    uint32_t threadCount = options->threads;
+    if (threadCount == 0) {
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = processors > 0 ? processors : 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_t *threads = malloc(threadCount * sizeof(pthread_t));
+    for (uint32_t t = 0; t < threadCount; t++) {
+        pthread_create(&threads[t], NULL, batchWorker, &batch);
+    }
+    for (uint32_t t = 0; t < threadCount; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fflush(stdout);
+
+    const double seconds = (end.tv_sec - start.tv_sec)
+        + (end.tv_nsec - start.tv_nsec) / 1e9;
+    const uint32_t total = batch.latencyCount;
+
+    qsort(batch.latencies, total, sizeof(double), compareDoubles);
+    fprintf(stderr,
+        "Solved %u of %u boards in %.3f s on %u threads (%.1f boards/s).\n"
+        "Latency: p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms.\n",
+        batch.solved, total, seconds, threadCount,
+        seconds > 0 ? total / seconds : 0,
+        percentile(batch.latencies, total, 0.50),
+        percentile(batch.latencies, total, 0.90),
+        percentile(batch.latencies, total, 0.99),
+        percentile(batch.latencies, total, 1.00)
+    );
+
+    const uint8_t allSolved = batch.solved == total;
+    for (uint32_t f = 0; f < batch.fileCount; f++) free(batch.files[f]);
+    free(batch.files);
+    free(batch.directory);
+    free(batch.pending);
+    free(batch.latencies);
+    pthread_mutex_destroy(&batch.inputLock);
+    pthread_mutex_destroy(&batch.outputLock);
+
+    return allSolved ? 0 : -1;
+}
+
+
+void *batchWorker(void *arg) {
+    batch_t *batch = arg;
+
+    // Checkpoints are for a single long search, not for a pile of boards.
+    solveOptions_t options = batch->options->solve;
+    options.checkpointPath = NULL;
+
+    job_t job;
+    while (takeJob(batch, &job)) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        board_t board;
+        solveStats_t stats = {0};
+        const char *error = NULL;
+        if (readPuzzle(&job.puzzle, &board, NULL)) {
+            error = "invalid";
+        }
+        else {
+            board = solveWith(board, &options, &stats);
+            if (board.size == 0) error = "unsolvable";
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        const double ms = (end.tv_sec - start.tv_sec) * 1e3
+            + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+        char *line;
+        size_t lineLength;
+        FILE *out = open_memstream(&line, &lineLength);
+
+        fprintf(out, "{\"id\":");
+        writeId(out, &job);
+        if (error) {
+            writeResult(out, error, 0, NULL, ms, stats);
+        }
+        else {
+            uint8_t solution[board.size];
+            getSolution(board, solution);
+            writeResult(out, NULL, board.size, solution, ms, stats);
+            freeBoard(board);
+        }
+        fclose(out);
+
+        finishJob(batch, &job);
+        report(batch, job.index, line, ms, error == NULL);
+    }
+
+    return NULL;
+}
+
+
+// Gets the next board, opening the next file when needed.
+// Returns 0 when there aren't any left.
+int takeJob(batch_t *batch, job_t *job) {
+    pthread_mutex_lock(&batch->inputLock);
+
+    while (1) {
+        if (batch->current == NULL) {
+            batch->current = openNextCorpus(batch);
+            if (batch->current == NULL) {
+                pthread_mutex_unlock(&batch->inputLock);
+                return 0;
+            }
+        }
+
+        openCorpus_t *source = batch->current;
+        if (nextPuzzle(&source->corpus, &job->puzzle)) {
+            job->index = batch->nextIndex++;
+            job->source = source;
+            source->users++;
+
+            // Have a peek at whether there's more after it.
+            job->single = 0;
+            if (source->name && job->puzzle.index == 0) {
+                corpus_t peek = source->corpus;
+                puzzleView_t next;
+                job->single = !nextPuzzle(&peek, &next);
+            }
+            break;
+        }
+
+        // This one's done. It gets closed by the last board using it.
+        source->exhausted = 1;
+        batch->current = NULL;
+        if (source->users == 0) {
+            closeCorpus(&source->corpus);
+            free(source->name);
+            free(source);
+        }
+    }
+
+    pthread_mutex_unlock(&batch->inputLock);
+    return 1;
+}
+
+
+void finishJob(batch_t *batch, job_t *job) {
+    pthread_mutex_lock(&batch->inputLock);
+
+    openCorpus_t *source = job->source;
+    if (--source->users == 0 && source->exhausted) {
+        closeCorpus(&source->corpus);
+        free(source->name);
+        free(source);
+    }
+
+    pthread_mutex_unlock(&batch->inputLock);
+}
+
+
+// Skips the files that can't be opened (after complaining about them).
+openCorpus_t *openNextCorpus(batch_t *batch) {
+    while (batch->nextFile < batch->fileCount) {
+        const char *name = batch->files[batch->nextFile++];
+
+        char path[strlen(name) + (batch->directory ? strlen(batch->directory) : 0) + 2];
+        if (batch->directory) sprintf(path, "%s/%s", batch->directory, name);
+        else strcpy(path, name);
+
+        FILE *file = fopen(path, "rb");
+        if (file == NULL) {
+            fprintf(stderr, "Couldn't open %s.\n", path);
+            continue;
+        }
+
+        openCorpus_t *source = calloc(1, sizeof(openCorpus_t));
+        const int failed = openCorpus(file, &source->corpus);
+        fclose(file);
+        if (failed) {
+            free(source);
+            continue;
+        }
+
+        if (batch->directory) source->name = strdup(name);
+        return source;
+    }
+
+    return NULL;
+}
+
+
+void report(batch_t *batch, uint32_t index, char *line, double ms, uint8_t solved) {
+    pthread_mutex_lock(&batch->outputLock);
+
+    if (batch->latencyCount == batch->latencyCapacity) {
+        batch->latencyCapacity = batch->latencyCapacity ? batch->latencyCapacity * 2 : 1024;
+        batch->latencies = realloc(
+            batch->latencies, batch->latencyCapacity * sizeof(double)
+        );
+    }
+    batch->latencies[batch->latencyCount++] = ms;
+    batch->solved += solved;
+
+    if (batch->options->order == ORDER_COMPLETION) {
+        fputs(line, stdout);
+        free(line);
+        pthread_mutex_unlock(&batch->outputLock);
+        return;
+    }
+
+    // Keep it until every line before it is out.
+    if (index >= batch->pendingCapacity) {
+        uint32_t capacity = batch->pendingCapacity ? batch->pendingCapacity : 1024;
+        while (capacity <= index) capacity *= 2;
+        batch->pending = realloc(batch->pending, capacity * sizeof(char*));
+        memset(
+            batch->pending + batch->pendingCapacity, 0,
+            (capacity - batch->pendingCapacity) * sizeof(char*)
+        );
+        batch->pendingCapacity = capacity;
+    }
+    batch->pending[index] = line;
+
+    while (
+        batch->nextOutput < batch->pendingCapacity
+        && batch->pending[batch->nextOutput]
+    ) {
+        fputs(batch->pending[batch->nextOutput], stdout);
+        free(batch->pending[batch->nextOutput]);
+        batch->pending[batch->nextOutput] = NULL;
+        batch->nextOutput++;
+    }
+
+    pthread_mutex_unlock(&batch->outputLock);
+}
+
+
+// The board's ID in the corpus (or its index if it doesn't have one),
+// after the file name if there are multiple files.
+void writeId(FILE *out, job_t *job) {
+    char number[16];
+    const char *id = job->puzzle.id;
+    uint32_t idLength = job->puzzle.idLength;
+    if (id == NULL) {
+        idLength = sprintf(number, "%u", job->puzzle.index);
+        id = number;
+    }
+
+    const char *name = job->source->name;
+    if (name == NULL) {
+        writeJsonString(out, id, idLength);
+        return;
+    }
+
+    // A file with just the one board is just called after the file.
+    const uint8_t single = job->single && job->puzzle.id == NULL;
+
+    const uint32_t nameLength = strlen(name);
+    char full[nameLength + idLength + 2];
+    memcpy(full, name, nameLength);
+    uint32_t length = nameLength;
+    if (!single) {
+        full[length++] = ':';
+        memcpy(full + length, id, idLength);
+        length += idLength;
+    }
+    writeJsonString(out, full, length);
+}
+
+
+void writeResult(
+    FILE *out, const char *error, uint32_t size, const uint8_t *solution,
+    double ms, solveStats_t stats
+) {
+    if (error) {
+        fprintf(out, ",\"error\":\"%s\"", error);
+    }
+    else {
+        fprintf(out, ",\"size\":%u,\"solution\":[", size);
+        for (uint32_t y = 0; y < size; y++) {
+            fprintf(out, y ? ",%u" : "%u", solution[y]);
+        }
+        fprintf(out, "]");
+    }
+    fprintf(out,
+        ",\"ms\":%.3f,\"nodes\":%" PRIu64 ",\"passes\":%" PRIu64 "}\n",
+        ms, stats.nodes, stats.passes
+    );
+}
+
+
+void writeJsonString(FILE *out, const char *string, uint32_t length) {
+    fputc('"', out);
+    for (uint32_t i = 0; i < length; i++) {
+        const unsigned char c = string[i];
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c < 0x20) fprintf(out, "\\u%04x", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+
+// Every regular file in the directory, sorted by name
+// (so the input order doesn't depend on the filesystem).
+int listFiles(batch_t *batch, const char *directory) {
+    DIR *dir = opendir(directory);
+    if (dir == NULL) {
+        fprintf(stderr, "Couldn't open directory %s.\n", directory);
+        return -1;
+    }
+
+    batch->directory = strdup(directory);
+    uint32_t capacity = 64;
+    batch->files = malloc(capacity * sizeof(char*));
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+
+        char path[strlen(directory) + strlen(entry->d_name) + 2];
+        sprintf(path, "%s/%s", directory, entry->d_name);
+        struct stat info;
+        if (stat(path, &info) || !S_ISREG(info.st_mode)) continue;
+
+        if (batch->fileCount == capacity) {
+            capacity *= 2;
+            batch->files = realloc(batch->files, capacity * sizeof(char*));
+        }
+        batch->files[batch->fileCount++] = strdup(entry->d_name);
+    }
+    closedir(dir);
+
+    qsort(batch->files, batch->fileCount, sizeof(char*), compareStrings);
+    return 0;
+}
+
+
+int compareStrings(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+int compareDoubles(const void *a, const void *b) {
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+
+// Nearest rank.
+double percentile(double *sorted, uint32_t count, double fraction) {
+    if (count == 0) return 0;
+    uint32_t rank = fraction * count + 0.999999;
+    if (rank == 0) rank = 1;
+    if (rank > count) rank = count;
+    return sorted[rank - 1];
+}
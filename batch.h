@@ -0,0 +1,43 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "solver.h"
+
+
+// In what order the results of a batch get printed.
+typedef enum {
+    // The same order as the boards were in.
+    ORDER_INPUT = 0,
+    // As soon as they're solved.
+    ORDER_COMPLETION,
+} batchOrder_t;
+
+
+typedef struct {
+    batchOrder_t order;
+    // 0 means one for every processor.
+    uint32_t threads;
+    solveOptions_t solve;
+} batchOptions_t;
+
+
+// Solves every board in a corpus, or in every file (corpus) in
+// a directory, on a bunch of threads. Prints a line of JSON for every
+// board to stdout, and how fast it all went to stderr.
+// Returns 0 if every board got solved.
+int solveBatch(const char *path, batchOptions_t *options);
+
+// Writes the rest of a result line, after {"id":ID.
+// Either error or the solution (the column of the queen on every row).
+void writeResult(
+    FILE *out, const char *error, uint32_t size, const uint8_t *solution,
+    double ms, solveStats_t stats
+);
+// Writes a quoted JSON string.
+void writeJsonString(FILE *out, const char *string, uint32_t length);
+
+
+#endif // BATCH_H
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "binary.h"
+#include "types.h"
+#include "util.h"
+
+
+static uint32_t colorBits(uint32_t regions);
+
+
+uint8_t isBinaryBoard(const void *data, size_t length) {
+    return length >= 3
+        && memcmp(data, BINARY_MAGIC, 2) == 0
+        && ((const uint8_t *)data)[2] == BINARY_VERSION;
+}
+
+
+size_t binaryBoardLength(const void *data, size_t length) {
+    const uint8_t *header = data;
+
+    if (length < BINARY_HEADER_SIZE || !isBinaryBoard(data, length)) return 0;
+
+    const uint32_t size = header[4];
+    const uint32_t bits = header[6];
+    if (size == 0 || bits < BINARY_MIN_BITS || bits > BINARY_MAX_BITS) {
+        return 0;
+    }
+
+    size_t total = BINARY_HEADER_SIZE + (size * size * bits + 7) / 8;
+    if (header[3] & BINARY_HAS_SOLUTION) total += size;
+
+    return total;
+}
+
+
+uint8_t *packBoard(board_t board, const uint8_t *solution, size_t *length) {
+    const uint32_t size = board.size;
+    if (size > BINARY_MAX_SIZE) return NULL;
+    const uint32_t bits = colorBits(size);
+    const size_t colorBytes = (size * size * bits + 7) / 8;
+
+    *length = BINARY_HEADER_SIZE + colorBytes + (solution ? size : 0);
+    uint8_t *buffer = calloc(*length, 1);
+
+    buffer[0] = BINARY_MAGIC[0];
+    buffer[1] = BINARY_MAGIC[1];
+    buffer[2] = BINARY_VERSION;
+    buffer[3] = solution ? BINARY_HAS_SOLUTION : 0;
+    buffer[4] = size;
+    buffer[5] = size;
+    buffer[6] = bits;
+
+    // The colors, lowest bits first.
+    uint8_t *colors = buffer + BINARY_HEADER_SIZE;
+    uint32_t bit = 0;
+    for (uint32_t i = 0; i < size * size; i++) {
+        const uint32_t color = board.cells[i].color;
+        for (uint32_t b = 0; b < bits; b++, bit++) {
+            if (color >> b & 1) colors[bit / 8] |= 1 << (bit % 8);
+        }
+    }
+
+    if (solution) memcpy(colors + colorBytes, solution, size);
+
+    const uint32_t checksum = fnv1a(
+        buffer + BINARY_HEADER_SIZE, *length - BINARY_HEADER_SIZE
+    );
+    for (uint32_t i = 0; i < 4; i++) {
+        buffer[8 + i] = checksum >> (8 * i);
+    }
+
+    return buffer;
+}
+
+
+int unpackBoard(
+    const void *data, size_t length, board_t *board, uint8_t **solution
+) {
+    const uint8_t *buffer = data;
+
+    const size_t expected = binaryBoardLength(data, length);
+    if (expected == 0 || expected > length) {
+        fprintf(stderr, "This isn't a (whole) binary board.\n");
+        return -1;
+    }
+
+    const uint32_t size = buffer[4];
+    const uint32_t bits = buffer[6];
+    const uint8_t hasSolution = buffer[3] & BINARY_HAS_SOLUTION;
+
+    uint32_t checksum = 0;
+    for (uint32_t i = 0; i < 4; i++) {
+        checksum |= (uint32_t)buffer[8 + i] << (8 * i);
+    }
+    if (
+        checksum != fnv1a(
+            buffer + BINARY_HEADER_SIZE, expected - BINARY_HEADER_SIZE
+        )
+    ) {
+        fprintf(stderr, "The checksum of this binary board is wrong.\n");
+        return -1;
+    }
+    if (buffer[5] != size) {
+        fprintf(stderr,
+            "This binary board has %u colors, but it should have %u.\n",
+            buffer[5], size
+        );
+        return -1;
+    }
+
+    const uint8_t *packed = buffer + BINARY_HEADER_SIZE;
+    uint32_t *colors = malloc(size * size * sizeof(uint32_t));
+    uint32_t bit = 0;
+    for (uint32_t i = 0; i < size * size; i++) {
+        uint32_t color = 0;
+        for (uint32_t b = 0; b < bits; b++, bit++) {
+            color |= (packed[bit / 8] >> (bit % 8) & 1) << b;
+        }
+
+        if (color >= size) {
+            fprintf(stderr, "This binary board has a color that's too big.\n");
+            free(colors);
+            return -1;
+        }
+        colors[i] = color;
+    }
+
+    if (solution) {
+        *solution = NULL;
+        if (hasSolution) {
+            *solution = malloc(size);
+            memcpy(*solution, packed + (size * size * bits + 7) / 8, size);
+
+            for (uint32_t y = 0; y < size; y++) {
+                if ((*solution)[y] < size) continue;
+                fprintf(stderr, "The solution of this binary board is broken.\n");
+                free(*solution);
+                *solution = NULL;
+                free(colors);
+                return -1;
+            }
+        }
+    }
+
+    *board = createBoard(size);
+    colorBoard(*board, colors);
+    free(colors);
+
+    return 0;
+}
+
+
+// At least 4 bits, so most boards line up nicely with bytes.
+uint32_t colorBits(uint32_t regions) {
+    uint32_t bits = BINARY_MIN_BITS;
+    while ((1u << bits) < regions) bits++;
+    return bits;
+}
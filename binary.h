@@ -0,0 +1,55 @@
+#ifndef BINARY_H
+#define BINARY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "types.h"
+
+
+// Binary board layout (numbers little endian):
+//   "QB", version (1 byte), flags (1 byte), size (1 byte),
+//   region count (1 byte), bits per color (1 byte), reserved (1 byte),
+//   FNV-1a checksum of everything after the header (4 bytes),
+//   colors (bits per color for every cell, padded to a whole byte),
+//   and if BINARY_HAS_SOLUTION is set, the column of the queen
+//   on every row (1 byte per row).
+#define BINARY_MAGIC "QB"
+#define BINARY_VERSION 1
+#define BINARY_HEADER_SIZE 12
+
+#define BINARY_HAS_SOLUTION 1
+
+// Colors get the fewest bits that fit the region count, but at least 4.
+// Real boards stay within 4 to 6 bits (up to 64 regions), the 7 and 8
+// are there so every board up to BINARY_MAX_SIZE fits.
+#define BINARY_MIN_BITS 4
+#define BINARY_MAX_BITS 8
+
+// The size is one byte, so bigger boards don't fit.
+#define BINARY_MAX_SIZE 255
+
+
+// Whether this looks like a binary board: the magic, and a version
+// that's known. Text boards can start with "QB" too, so only
+// binaryBoardLength can really tell.
+uint8_t isBinaryBoard(const void *data, size_t length);
+
+// Returns how many bytes the binary board at data takes up,
+// or 0 if there isn't a (whole) valid header there.
+size_t binaryBoardLength(const void *data, size_t length);
+
+// Packs a colored board into a new buffer. solution can be NULL,
+// otherwise it holds the column of the queen on every row.
+// Returns NULL if the board is bigger than BINARY_MAX_SIZE.
+uint8_t *packBoard(board_t board, const uint8_t *solution, size_t *length);
+
+// Creates (and colors) a board from a binary one.
+// If solution isn't NULL, it gets the solution (to be freed),
+// or NULL if there wasn't one.
+int unpackBoard(
+    const void *data, size_t length, board_t *board, uint8_t **solution
+);
+
+
+#endif // BINARY_H
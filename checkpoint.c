@@ -0,0 +1,309 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "types.h"
+#include "util.h"
+
+
+// Checkpoint file layout (all numbers little endian):
+//   "QCKP", version (1 byte), size (1 byte), depth (2 bytes),
+//   nodes (8 bytes), elapsed ms (8 bytes),
+//   colors (1 byte per cell), types (2 bits per cell),
+//   decisions (2 bytes each), FNV-1a checksum of all of the above (4 bytes).
+#define CHECKPOINT_MAGIC "QCKP"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_HEADER_SIZE 24
+
+
+struct checkpointer_struct {
+    char *path;
+    char *tmpPath;
+    uint32_t interval;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+
+    // Everything below is protected by the lock.
+    checkpoint_t pending;
+    uint8_t hasPending;
+    uint8_t stopping;
+
+    // Only touched by the search thread.
+    struct timespec start;
+    uint64_t previousMs;
+    uint64_t lastOfferMs;
+};
+
+
+static void *writerThread(void *arg);
+static int writeCheckpoint(const char *path, const char *tmpPath, checkpoint_t *checkpoint);
+
+
+checkpointer_t *startCheckpointer(
+    const char *path, uint32_t interval, board_t root, uint64_t elapsedMs
+) {
+    if (root.size > CHECKPOINT_MAX_SIZE) {
+        fprintf(stderr,
+            "A %ux%u board is too big to checkpoint, searching without.\n",
+            root.size, root.size
+        );
+        return NULL;
+    }
+
+    checkpointer_t *cp = calloc(1, sizeof(checkpointer_t));
+
+    cp->path = strdup(path);
+    cp->tmpPath = malloc(strlen(path) + 5);
+    sprintf(cp->tmpPath, "%s.tmp", path);
+    cp->interval = interval;
+
+    const uint32_t cellCount = root.size * root.size;
+    cp->pending.size = root.size;
+    cp->pending.colors = malloc(cellCount);
+    cp->pending.types = malloc(cellCount);
+    cp->pending.decisions = malloc(root.size * sizeof(uint32_t));
+    for (uint32_t c = 0; c < cellCount; c++) {
+        cp->pending.colors[c] = root.cells[c].color;
+        cp->pending.types[c] = root.cells[c].type;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &cp->start);
+    cp->previousMs = elapsedMs;
+
+    pthread_mutex_init(&cp->lock, NULL);
+    pthread_cond_init(&cp->wake, NULL);
+    pthread_create(&cp->thread, NULL, writerThread, cp);
+
+    return cp;
+}
+
+
+void offerCheckpoint(
+    checkpointer_t *cp, uint32_t *decisions, uint32_t depth, uint64_t nodes
+) {
+    uint64_t now = millisSince(cp->start);
+    if (now - cp->lastOfferMs < cp->interval * 1000ull) return;
+
+    // The writer is busy with the previous one, try again later.
+    if (pthread_mutex_trylock(&cp->lock)) return;
+
+    memcpy(cp->pending.decisions, decisions, depth * sizeof(uint32_t));
+    cp->pending.depth = depth;
+    cp->pending.nodes = nodes;
+    cp->pending.elapsedMs = cp->previousMs + now;
+    cp->hasPending = 1;
+    cp->lastOfferMs = now;
+
+    pthread_cond_signal(&cp->wake);
+    pthread_mutex_unlock(&cp->lock);
+}
+
+
+void stopCheckpointer(checkpointer_t *cp) {
+    pthread_mutex_lock(&cp->lock);
+    cp->stopping = 1;
+    pthread_cond_signal(&cp->wake);
+    pthread_mutex_unlock(&cp->lock);
+
+    pthread_join(cp->thread, NULL);
+
+    // There's nothing left to resume.
+    remove(cp->path);
+
+    pthread_mutex_destroy(&cp->lock);
+    pthread_cond_destroy(&cp->wake);
+    freeCheckpoint(cp->pending);
+    free(cp->path);
+    free(cp->tmpPath);
+    free(cp);
+}
+
+
+void *writerThread(void *arg) {
+    checkpointer_t *cp = arg;
+
+    // The colors and types never change, so those can be shared.
+    checkpoint_t local = cp->pending;
+    local.decisions = malloc(cp->pending.size * sizeof(uint32_t));
+
+    pthread_mutex_lock(&cp->lock);
+    while (1) {
+        while (!cp->hasPending && !cp->stopping) {
+            pthread_cond_wait(&cp->wake, &cp->lock);
+        }
+        if (cp->stopping) break;
+
+        // Copy it out, so the search can hand over the next one
+        // while this one is being written.
+        memcpy(local.decisions, cp->pending.decisions,
+            cp->pending.depth * sizeof(uint32_t)
+        );
+        local.depth = cp->pending.depth;
+        local.nodes = cp->pending.nodes;
+        local.elapsedMs = cp->pending.elapsedMs;
+        cp->hasPending = 0;
+
+        pthread_mutex_unlock(&cp->lock);
+
+        if (writeCheckpoint(cp->path, cp->tmpPath, &local)) {
+            fprintf(stderr, "Couldn't write checkpoint %s.\n", cp->path);
+        }
+
+        pthread_mutex_lock(&cp->lock);
+    }
+    pthread_mutex_unlock(&cp->lock);
+
+    free(local.decisions);
+    return NULL;
+}
+
+
+// Writes to a temporary file first and renames it over the old checkpoint,
+// so a crash while writing never leaves a broken checkpoint behind.
+int writeCheckpoint(const char *path, const char *tmpPath, checkpoint_t *checkpoint) {
+    const uint32_t cellCount = checkpoint->size * checkpoint->size;
+    const size_t length = CHECKPOINT_HEADER_SIZE + cellCount
+        + (cellCount + 3) / 4 + checkpoint->depth * 2 + 4;
+
+    uint8_t *buffer = calloc(length, 1);
+    uint8_t *p = buffer;
+
+    memcpy(p, CHECKPOINT_MAGIC, 4);
+    p[4] = CHECKPOINT_VERSION;
+    p[5] = checkpoint->size;
+    p[6] = checkpoint->depth;
+    p[7] = checkpoint->depth >> 8;
+    for (uint8_t i = 0; i < 8; i++) {
+        p[8 + i] = checkpoint->nodes >> (8 * i);
+        p[16 + i] = checkpoint->elapsedMs >> (8 * i);
+    }
+    p += CHECKPOINT_HEADER_SIZE;
+
+    memcpy(p, checkpoint->colors, cellCount);
+    p += cellCount;
+
+    for (uint32_t c = 0; c < cellCount; c++) {
+        p[c / 4] |= (checkpoint->types[c] & 3) << (2 * (c % 4));
+    }
+    p += (cellCount + 3) / 4;
+
+    for (uint32_t d = 0; d < checkpoint->depth; d++) {
+        *p++ = checkpoint->decisions[d];
+        *p++ = checkpoint->decisions[d] >> 8;
+    }
+
+    uint32_t checksum = fnv1a(buffer, p - buffer);
+    for (uint8_t i = 0; i < 4; i++) {
+        *p++ = checksum >> (8 * i);
+    }
+
+    FILE *file = fopen(tmpPath, "wb");
+    if (file == NULL) {
+        free(buffer);
+        return -1;
+    }
+
+    size_t written = fwrite(buffer, 1, length, file);
+    fflush(file);
+    fsync(fileno(file));
+    fclose(file);
+    free(buffer);
+
+    if (written != length) return -1;
+
+    return rename(tmpPath, path);
+}
+
+
+int loadCheckpoint(const char *path, checkpoint_t *checkpoint) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Checkpoint %s not found.\n", path);
+        return -1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t *buffer = malloc(length > 0 ? length : 1);
+    size_t read = fread(buffer, 1, length, file);
+    fclose(file);
+
+    if (
+        length < CHECKPOINT_HEADER_SIZE + 4
+        || read != (size_t)length
+        || memcmp(buffer, CHECKPOINT_MAGIC, 4) != 0
+        || buffer[4] != CHECKPOINT_VERSION
+    ) {
+        fprintf(stderr, "%s is not a checkpoint I can read.\n", path);
+        free(buffer);
+        return -1;
+    }
+
+    checkpoint_t cp = {0};
+    cp.size = buffer[5];
+    cp.depth = buffer[6] | (buffer[7] << 8);
+    for (uint8_t i = 0; i < 8; i++) {
+        cp.nodes |= (uint64_t)buffer[8 + i] << (8 * i);
+        cp.elapsedMs |= (uint64_t)buffer[16 + i] << (8 * i);
+    }
+
+    const uint32_t cellCount = cp.size * cp.size;
+    const size_t expected = CHECKPOINT_HEADER_SIZE + cellCount
+        + (cellCount + 3) / 4 + cp.depth * 2 + 4;
+
+    uint32_t checksum = 0;
+    if ((size_t)length == expected) {
+        for (uint8_t i = 0; i < 4; i++) {
+            checksum |= (uint32_t)buffer[expected - 4 + i] << (8 * i);
+        }
+    }
+
+    if (
+        (size_t)length != expected
+        || cp.depth > cp.size
+        || checksum != fnv1a(buffer, expected - 4)
+    ) {
+        fprintf(stderr, "Checkpoint %s is corrupted.\n", path);
+        free(buffer);
+        return -1;
+    }
+
+    uint8_t *p = buffer + CHECKPOINT_HEADER_SIZE;
+
+    cp.colors = malloc(cellCount);
+    memcpy(cp.colors, p, cellCount);
+    p += cellCount;
+
+    cp.types = malloc(cellCount);
+    for (uint32_t c = 0; c < cellCount; c++) {
+        cp.types[c] = (p[c / 4] >> (2 * (c % 4))) & 3;
+    }
+    p += (cellCount + 3) / 4;
+
+    cp.decisions = malloc((cp.size ? cp.size : 1) * sizeof(uint32_t));
+    for (uint32_t d = 0; d < cp.depth; d++) {
+        cp.decisions[d] = p[0] | (p[1] << 8);
+        p += 2;
+    }
+
+    free(buffer);
+    *checkpoint = cp;
+
+    return 0;
+}
+
+
+void freeCheckpoint(checkpoint_t checkpoint) {
+    free(checkpoint.colors);
+    free(checkpoint.types);
+    free(checkpoint.decisions);
+}
@@ -0,0 +1,59 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+
+// How often (in seconds) a checkpoint gets written, unless told otherwise.
+#define DEFAULT_CHECKPOINT_INTERVAL 60
+
+// The size and every color are one byte in the file,
+// so bigger boards don't fit.
+#define CHECKPOINT_MAX_SIZE 255
+
+
+// Everything needed to pick a search back up:
+// the board as it was when the search started,
+// and the queens the search had placed at the time.
+typedef struct {
+    uint32_t size;
+
+    // One color and one CELL_ type per cell.
+    uint8_t *colors;
+    uint8_t *types;
+
+    // The cell index of the queen at every depth.
+    uint32_t *decisions;
+    uint32_t depth;
+
+    // Statistics of the search so far.
+    uint64_t nodes;
+    uint64_t elapsedMs;
+} checkpoint_t;
+
+
+// Writes checkpoints on its own thread, so the search doesn't have to wait.
+typedef struct checkpointer_struct checkpointer_t;
+
+// root is the board the search starts from.
+// Returns NULL if the board is too big to be checkpointed.
+checkpointer_t *startCheckpointer(
+    const char *path, uint32_t interval, board_t root, uint64_t elapsedMs
+);
+// Hands the search's current state to the writer if a checkpoint is due.
+// Never blocks; if the writer is busy it tries again next time.
+void offerCheckpoint(
+    checkpointer_t *checkpointer,
+    uint32_t *decisions, uint32_t depth, uint64_t nodes
+);
+// Stops the writer once the search is done,
+// and removes the checkpoint file.
+void stopCheckpointer(checkpointer_t *checkpointer);
+
+int loadCheckpoint(const char *path, checkpoint_t *checkpoint);
+void freeCheckpoint(checkpoint_t checkpoint);
+
+
+#endif // CHECKPOINT_H
@@ -5,26 +5,61 @@
 #include "looker.h"
 
 
+static void clickCell(
+    session_t *session, cell_t *cell, boardScreenInfo_t screenInfo,
+    uint8_t clicks
+);
 
+
+// Clicking a cell cycles it from empty to crossed to queen and back.
 void clickSolveBoard(
-    board_t solution, boardScreenInfo_t screenInfo, uint32_t delay
+    session_t *session, board_t solution, boardScreenInfo_t screenInfo,
+    uint32_t delay, uint8_t *marks
 ) {
 
-    initClicking();
+    if (!session->hasXTest) {
+        fprintf(stderr, "Can't click without the XTest extension.\n");
+        return;
+    }
 
     for (uint32_t s = 0; s < solution.size; s++) {
         cell_t *cell = solution.columns[s].cells[0];
-        moveMouseTo(
-            screenInfo.x + cell->x * screenInfo.offset,
-            screenInfo.y + cell->y * screenInfo.offset
-        );
-        doubleClickMouse();
-        printf("Clicking %d, %d\n",
-            screenInfo.x + cell->x * screenInfo.offset,
-            screenInfo.y + cell->y * screenInfo.offset
-        );
+        uint8_t mark = marks ? marks[cell->x + cell->y * solution.size] : 0;
+
+        if (mark == CELL_QUEEN) continue;
+
+        clickCell(session, cell, screenInfo, mark == CELL_CROSSED ? 1 : 2);
+        usleep(delay);
+    }
+
+    if (marks == NULL) return;
+
+    // Get rid of queens that were put in the wrong place.
+    for (uint32_t c = 0; c < solution.size * solution.size; c++) {
+        cell_t *cell = &solution.cells[c];
+        if (marks[c] != CELL_QUEEN) continue;
+        if (cell->column->cells[0] == cell) continue;
+
+        clickCell(session, cell, screenInfo, 1);
         usleep(delay);
     }
+}
+
+
+void clickCell(
+    session_t *session, cell_t *cell, boardScreenInfo_t screenInfo,
+    uint8_t clicks
+) {
+    moveMouseTo(session,
+        screenInfo.x + cell->x * screenInfo.offset,
+        screenInfo.y + cell->y * screenInfo.offset
+    );
+
+    if (clicks == 2) doubleClickMouse(session);
+    else clickMouse(session);
 
-    stopClicking();
+    printf("Clicking %d, %d\n",
+        screenInfo.x + cell->x * screenInfo.offset,
+        screenInfo.y + cell->y * screenInfo.offset
+    );
 }
@@ -5,8 +5,11 @@
 #include "seeer.h"
 
 
+// marks holds what was on the screen before solving (see detectBoard),
+// so cells that are already right don't get clicked. It can be NULL.
 void clickSolveBoard(
-    board_t solution, boardScreenInfo_t screenInfo, uint32_t delay
+    session_t *session, board_t solution, boardScreenInfo_t screenInfo,
+    uint32_t delay, uint8_t *marks
 );
 
 
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "binary.h"
+#include "convert.h"
+#include "corpus.h"
+#include "solver.h"
+#include "types.h"
+
+
+// Characters for the cells of a board written as text,
+// one per color. Bigger boards get numbers instead.
+static const char cellCharacters[] =
+    "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+
+static void writeTextBoard(FILE *out, board_t board, uint8_t *solution);
+
+
+int convertCorpus(FILE *in, FILE *out, solveOptions_t *options) {
+    corpus_t corpus;
+    if (openCorpus(in, &corpus)) return -1;
+
+    uint32_t converted = 0;
+    puzzleView_t puzzle;
+    while (nextPuzzle(&corpus, &puzzle)) {
+        board_t board;
+        uint8_t *solution;
+        if (readPuzzle(&puzzle, &board, &solution)) {
+            fprintf(stderr, "Skipping board %u.\n", puzzle.index);
+            continue;
+        }
+        if (!corpus.binary && board.size > BINARY_MAX_SIZE) {
+            fprintf(stderr,
+                "Board %u is too big for a binary board, skipping it.\n",
+                puzzle.index
+            );
+            free(solution);
+            freeBoard(board);
+            continue;
+        }
+
+        if (solution == NULL && options) {
+            board_t solved = solveWith(copyBoard(board), options, NULL);
+            if (solved.size) {
+                solution = malloc(board.size);
+                getSolution(solved, solution);
+                freeBoard(solved);
+            }
+            else {
+                fprintf(stderr,
+                    "Board %u can't be solved, so it doesn't get a solution.\n",
+                    puzzle.index
+                );
+            }
+        }
+
+        if (corpus.binary) {
+            if (converted) fprintf(out, "\n");
+            writeTextBoard(out, board, solution);
+        }
+        else {
+            size_t length;
+            uint8_t *packed = packBoard(board, solution, &length);
+            fwrite(packed, 1, length, out);
+            free(packed);
+        }
+
+        free(solution);
+        freeBoard(board);
+        converted++;
+    }
+
+    const uint32_t count = corpus.count;
+    closeCorpus(&corpus);
+
+    if (ferror(out)) {
+        fprintf(stderr, "Couldn't write the converted boards.\n");
+        return -1;
+    }
+
+    printf("Converted %u of %u boards.\n", converted, count);
+    return converted == count ? 0 : -1;
+}
+
+
+void writeTextBoard(FILE *out, board_t board, uint8_t *solution) {
+    if (solution) {
+        fprintf(out, "# solution");
+        for (uint32_t y = 0; y < board.size; y++) {
+            fprintf(out, " %u", solution[y]);
+        }
+        fprintf(out, "\n");
+    }
+
+    const uint8_t useCharacters = board.size < sizeof(cellCharacters);
+    for (uint32_t y = 0; y < board.size; y++) {
+        for (uint32_t x = 0; x < board.size; x++) {
+            const uint32_t color = board.cells[y * board.size + x].color;
+            if (useCharacters) fputc(cellCharacters[color], out);
+            else fprintf(out, x ? " %u" : "%u", color);
+        }
+        fprintf(out, "\n");
+    }
+}
@@ -0,0 +1,15 @@
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stdio.h>
+
+#include "solver.h"
+
+
+// Writes every board of a text corpus to out as binary boards,
+// or the other way around. With options, boards that don't have a
+// solution yet get solved, so it can be stored with them.
+int convertCorpus(FILE *in, FILE *out, solveOptions_t *options);
+
+
+#endif // CONVERT_H
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "binary.h"
+#include "corpus.h"
+#include "reader.h"
+#include "types.h"
+
+
+static size_t lineEnd(corpus_t *corpus, size_t start);
+static size_t skipSpaces(corpus_t *corpus, size_t start, size_t end);
+static int parseSolution(puzzleView_t *puzzle, uint32_t size, uint8_t *solution);
+
+
+int openCorpus(FILE *file, corpus_t *corpus) {
+    memset(corpus, 0, sizeof(corpus_t));
+
+    // A big corpus gets mapped, so boards never get copied anywhere.
+    corpus->text = loadFile(file, &corpus->length, &corpus->mapped);
+    if (corpus->text == NULL) {
+        fprintf(stderr, "Couldn't read the corpus.\n");
+        return -1;
+    }
+    corpus->binary = binaryBoardLength(corpus->text, corpus->length) != 0;
+
+    return 0;
+}
+
+
+int nextPuzzle(corpus_t *corpus, puzzleView_t *puzzle) {
+    const char *text = corpus->text;
+    size_t i = corpus->offset;
+
+    memset(puzzle, 0, sizeof(puzzleView_t));
+
+    if (corpus->binary) {
+        if (i >= corpus->length) return 0;
+
+        const size_t length = binaryBoardLength(
+            text + i, corpus->length - i
+        );
+        if (length == 0 || length > corpus->length - i) {
+            fprintf(stderr,
+                "Binary board %u is broken, stopping there.\n", corpus->count
+            );
+            corpus->offset = corpus->length;
+            return 0;
+        }
+
+        puzzle->text = text + i;
+        puzzle->length = length;
+        puzzle->binary = 1;
+        puzzle->index = corpus->count++;
+        corpus->offset = i + length;
+        return 1;
+    }
+
+    // Find where the board starts. The last comment right before it
+    // (without a blank line in between) is its ID.
+    while (i < corpus->length) {
+        const size_t end = lineEnd(corpus, i);
+        const size_t start = skipSpaces(corpus, i, end);
+
+        if (start == end) {
+            puzzle->id = NULL;
+            puzzle->idLength = 0;
+            puzzle->solution = NULL;
+            puzzle->solutionLength = 0;
+        }
+        else if (text[start] == '#') {
+            size_t idStart = skipSpaces(corpus, start + 1, end);
+            size_t idEnd = end;
+            while (idEnd > idStart && isspace((unsigned char)text[idEnd - 1])) {
+                idEnd--;
+            }
+
+            if (
+                idEnd - idStart >= 8
+                && memcmp(text + idStart, "solution", 8) == 0
+                && (idEnd - idStart == 8 || isspace((unsigned char)text[idStart + 8]))
+            ) {
+                puzzle->solution = text + idStart + 8;
+                puzzle->solutionLength = idEnd - idStart - 8;
+            }
+            else {
+                puzzle->id = text + idStart;
+                puzzle->idLength = idEnd - idStart;
+            }
+        }
+        else break;
+
+        i = end + 1;
+    }
+
+    if (i >= corpus->length) {
+        corpus->offset = corpus->length;
+        return 0;
+    }
+
+    // The board goes on until a blank line or a comment.
+    puzzle->text = text + i;
+    while (i < corpus->length) {
+        const size_t end = lineEnd(corpus, i);
+        const size_t start = skipSpaces(corpus, i, end);
+        if (start == end || text[start] == '#') break;
+        i = end + 1;
+    }
+    if (i > corpus->length) i = corpus->length;
+
+    puzzle->length = text + i - puzzle->text;
+    puzzle->index = corpus->count++;
+    corpus->offset = i;
+
+    return 1;
+}
+
+
+void closeCorpus(corpus_t *corpus) {
+    unloadFile(corpus->text, corpus->length, corpus->mapped);
+    memset(corpus, 0, sizeof(corpus_t));
+}
+
+
+int readPuzzle(puzzleView_t *puzzle, board_t *board, uint8_t **solution) {
+    if (puzzle->binary) {
+        return unpackBoard(puzzle->text, puzzle->length, board, solution);
+    }
+
+    if (parseQueensText(puzzle->text, puzzle->length, board)) return -1;
+    if (solution == NULL) return 0;
+
+    *solution = NULL;
+    if (puzzle->solution == NULL) return 0;
+
+    *solution = malloc(board->size);
+    if (parseSolution(puzzle, board->size, *solution)) {
+        fprintf(stderr, "The solution of board %u is broken.\n", puzzle->index);
+        free(*solution);
+        *solution = NULL;
+        freeBoard(*board);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+// Returns the index of the newline at the end of the line
+// (or the end of the corpus).
+size_t lineEnd(corpus_t *corpus, size_t start) {
+    const char *newline = memchr(
+        corpus->text + start, '\n', corpus->length - start
+    );
+    if (newline == NULL) return corpus->length;
+    return newline - corpus->text;
+}
+
+
+size_t skipSpaces(corpus_t *corpus, size_t start, size_t end) {
+    while (start < end && isspace((unsigned char)corpus->text[start])) {
+        start++;
+    }
+    return start;
+}
+
+
+// The line isn't null terminated (it's in the middle of the corpus),
+// so no strtol here.
+int parseSolution(puzzleView_t *puzzle, uint32_t size, uint8_t *solution) {
+    const char *text = puzzle->solution;
+    uint32_t i = 0;
+    uint32_t count = 0;
+
+    while (1) {
+        while (i < puzzle->solutionLength && isspace((unsigned char)text[i])) i++;
+        if (i == puzzle->solutionLength) break;
+
+        if (!isdigit((unsigned char)text[i]) || count == size) return -1;
+
+        uint32_t column = 0;
+        while (i < puzzle->solutionLength && isdigit((unsigned char)text[i])) {
+            column = column * 10 + text[i++] - '0';
+            if (column >= size) return -1;
+        }
+        solution[count++] = column;
+    }
+
+    return count == size ? 0 : -1;
+}
@@ -0,0 +1,59 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "types.h"
+
+
+// A corpus is a file with a lot of boards in it.
+// Boards are separated by blank lines, and can have a "# ID" line
+// right before them. A "# solution" line in the same place holds
+// the column of the queen on every row. Other lines starting with # are
+// ignored. A corpus can also be a bunch of binary boards (see binary.h)
+// back to back.
+typedef struct {
+    const char *text;
+    size_t length;
+    uint8_t mapped;
+    uint8_t binary;
+
+    // Where the next board starts looking.
+    size_t offset;
+    uint32_t count;
+} corpus_t;
+
+// One board in a corpus. The pointers point right into the corpus,
+// so they are only good until it gets closed.
+typedef struct {
+    const char *id;
+    uint32_t idLength;
+
+    const char *text;
+    size_t length;
+    uint8_t binary;
+
+    // The numbers after "# solution", if there is one.
+    // Binary boards have their solution inside them.
+    const char *solution;
+    uint32_t solutionLength;
+
+    // Which board of the corpus this is (starting at 0).
+    uint32_t index;
+} puzzleView_t;
+
+
+int openCorpus(FILE *file, corpus_t *corpus);
+// Gets the next board in the corpus.
+// Returns 0 when there are no more boards.
+int nextPuzzle(corpus_t *corpus, puzzleView_t *puzzle);
+void closeCorpus(corpus_t *corpus);
+
+// Creates (and colors) the board. If solution isn't NULL, it gets the
+// board's solution (to be freed), or NULL if it doesn't have one.
+int readPuzzle(puzzleView_t *puzzle, board_t *board, uint8_t **solution);
+
+
+#endif // CORPUS_H
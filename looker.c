@@ -3,20 +3,38 @@
 
 #include <X11/X.h>
 #include <X11/Xlib.h>
+#include <X11/extensions/XShm.h>
 #include <X11/extensions/XTest.h>
+#include <X11/extensions/Xdamage.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#define MIN(i, j) (((i) < (j)) ? (i) : (j))
+#define MAX(i, j) (((i) > (j)) ? (i) : (j))
 
 // gcc -o seeer seeer.c -Wall -lX11
 
 #define PRINT_PROPERTIES_IN_TREE
 
 
-static uint8_t isBrowser(Display *display, Window window);
+static uint8_t isBrowser(session_t *session, Window window);
+static uint8_t updateGeometry(session_t *session);
+static image_t captureWindow(
+    session_t *session, rect_t *region, coord_t *browser_coords
+);
+static uint8_t prepareShmImage(
+    session_t *session, uint32_t width, uint32_t height
+);
+static void releaseShmImage(session_t *session);
+static int catchRequestError(Display *display, XErrorEvent *error);
+static void convertImage(XImage *image, image_t converted);
+static void getChannel(unsigned long mask, uint32_t *shift, uint32_t *bits);
 [[maybe_unused]]
 static void screenshotToFile(Display *display, char *fileName, Window window);
 [[maybe_unused]]
@@ -27,142 +45,404 @@ static void printProperties(Display *display, Window window);
 static void printKids(Display *display, Window *kids, uint32_t kidCount, uint32_t depth);
 
 
-image_t getBrowserWindow(Window browser, coord_t *browser_coords) {
+// Set by catchRequestError, for X requests that are allowed to fail.
+static uint8_t requestFailed;
 
-    image_t ret = {0};
 
-    Display *display = XOpenDisplay(NULL);
-    Window root = DefaultRootWindow(display);
+// ============ The session ============
 
-    if (browser == 0) {
-        browser = findBrowser(display, root, 0);
+int openSession(session_t *session, Window window) {
+    *session = (session_t){0};
+
+    session->display = XOpenDisplay(NULL);
+    if (session->display == NULL) {
+        fprintf(stderr, "Couldn't open the display.\n");
+        return -1;
     }
+    session->root = DefaultRootWindow(session->display);
 
-    // Get window attributes (width, height).
-    XWindowAttributes browser_attrs;
-    XGetWindowAttributes(display, browser, &browser_attrs);
-    int width = browser_attrs.width;
-    int height = browser_attrs.height;
+    // Everything that needs a round trip to the server, done once.
+    session->windowRole = XInternAtom(
+        session->display, "WM_WINDOW_ROLE", True
+    );
+    session->hasShm = XShmQueryExtension(session->display);
+    if (!session->hasShm) DPRINTF("No XShm, capturing the slow way\n");
 
-    // Get the window's image.
-    DPRINTF("getting image of [%d, %d]\n", width, height);
-    XImage *image =
-        XGetImage(display, browser, 0, 0, width, height, AllPlanes, ZPixmap);
+    int idc[4];
+    session->hasXTest = XTestQueryExtension(
+        session->display, &idc[0], &idc[1], &idc[2], &idc[3]
+    );
+    if (!session->hasXTest) DPRINTF("No XTest, so no clicking\n");
 
+    session->hasDamage = XDamageQueryExtension(
+        session->display, &session->damageEvents, &idc[0]
+    );
 
-    if (image == NULL) {
-        DPRINTF("Window is cringe\n");
-        XFree(display);
-        return ret;
+    session->window = window;
+    if (window == 0) {
+        session->window = findBrowser(session, session->root, 0);
+    }
+    if (session->window == 0 || !updateGeometry(session)) {
+        fprintf(stderr, "Couldn't find the browser window.\n");
+        closeSession(session);
+        return -1;
     }
-    DPRINTF("Got image\n");
 
+    return 0;
+}
 
-    // Find browser coordinates.
-    browser_coords->x = 0;
-    browser_coords->y = 0;
-    Window child = browser;
-    while (1) {
-        XWindowAttributes child_attrs;
-        XGetWindowAttributes(display, child, &child_attrs);
-        browser_coords->x += child_attrs.x;
-        browser_coords->y += child_attrs.y;
 
-        printf("Window 0x%lx adds %d, %d\n", child, child_attrs.x, child_attrs.y);
+void closeSession(session_t *session) {
+    if (session->display == NULL) return;
 
-        if (child == root) break;
+    releaseShmImage(session);
+    XCloseDisplay(session->display);
+    session->display = NULL;
+}
 
-        Window parent;
-        Window idc0;
-        Window *kids;
-        uint32_t idc1;
-        XQueryTree(display, child, &idc0, &parent, &kids, &idc1);
-        XFree(kids);
 
-        child = parent;
-    }
+// Gets where the window is on the screen, and how big it is.
+// Returns 0 if the window is gone.
+uint8_t updateGeometry(session_t *session) {
+    XWindowAttributes attrs;
+    requestFailed = 0;
+    XErrorHandler oldHandler = XSetErrorHandler(catchRequestError);
+    const Status got = XGetWindowAttributes(
+        session->display, session->window, &attrs
+    );
+    XSetErrorHandler(oldHandler);
+    if (!got || requestFailed) return 0;
+
+    session->width = attrs.width;
+    session->height = attrs.height;
+    session->depth = attrs.depth;
+    session->visual = attrs.visual;
+
+    Window idc;
+    XTranslateCoordinates(
+        session->display, session->window, session->root, 0, 0,
+        &session->windowCoords.x, &session->windowCoords.y, &idc
+    );
+    DPRINTF("Browser coords: %d, %d\n",
+        session->windowCoords.x, session->windowCoords.y
+    );
 
-    printf("Browser coords: %d, %d\n", browser_coords->x, browser_coords->y);
+    return 1;
+}
 
 
-    // Allocate the array.
-    pixel_t *array = malloc(width * height * sizeof(pixel_t));
+// ============ Capturing ============
 
-    unsigned long red_mask = image->red_mask;
-    unsigned long green_mask = image->green_mask;
-    unsigned long blue_mask = image->blue_mask;
+image_t getBrowserWindow(session_t *session, coord_t *browser_coords) {
+    if (!updateGeometry(session)) return (image_t){0};
+    return captureWindow(session, NULL, browser_coords);
+}
 
-    // Populate the array.
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            unsigned long pixel = image->f.get_pixel(image, x, y);
 
-            unsigned char blue = pixel & blue_mask;
-            unsigned char green = (pixel & green_mask) >> 8;
-            unsigned char red = (pixel & red_mask) >> 16;
+image_t getBrowserRegion(
+    session_t *session, rect_t *region, coord_t *browser_coords
+) {
+    // The window could have moved or shrunk since the last capture.
+    if (!updateGeometry(session)) return (image_t){0};
+    return captureWindow(session, region, browser_coords);
+}
+
 
-            array[(x + width * y)].r = red;
-            array[(x + width * y)].g = green;
-            array[(x + width * y)].b = blue;
+// Captures the region of the window, or all of it if region is NULL.
+// Goes by the geometry the session has, which the caller updates.
+image_t captureWindow(
+    session_t *session, rect_t *region, coord_t *browser_coords
+) {
+
+    image_t ret = {0};
+    Display *display = session->display;
+
+    int left = 0;
+    int top = 0;
+    int width = session->width;
+    int height = session->height;
+
+    // Only the part of the region that's actually in the window.
+    if (region) {
+        left = MAX(region->x, 0);
+        top = MAX(region->y, 0);
+        width = MIN(region->x + (int)region->width, width) - left;
+        height = MIN(region->y + (int)region->height, height) - top;
+        if (width <= 0 || height <= 0) {
+            DPRINTF("The region isn't in the window anymore\n");
+            return ret;
         }
+        *region = (rect_t){left, top, width, height};
     }
 
-    image->f.destroy_image(image);
-    XCloseDisplay(display);
+    // Get the window's image.
+    // Straight into the shared memory if the server can do that,
+    // otherwise it has to come through the socket.
+    DPRINTF("getting image of [%d, %d] at [%d, %d]\n", width, height, left, top);
+    XImage *image = NULL;
+    uint8_t shared = 0;
+    if (prepareShmImage(session, width, height)) {
+        requestFailed = 0;
+        XErrorHandler oldHandler = XSetErrorHandler(catchRequestError);
+        Bool got = XShmGetImage(
+            display, session->window, session->shmImage, left, top, AllPlanes
+        );
+        XSync(display, False);
+        XSetErrorHandler(oldHandler);
+
+        if (got && !requestFailed) {
+            image = session->shmImage;
+            shared = 1;
+        }
+    }
+    if (image == NULL) {
+        // The window can still change size right before this,
+        // which is an X error instead of a NULL.
+        requestFailed = 0;
+        XErrorHandler oldHandler = XSetErrorHandler(catchRequestError);
+        image = XGetImage(
+            display, session->window, left, top, width, height,
+            AllPlanes, ZPixmap
+        );
+        XSync(display, False);
+        XSetErrorHandler(oldHandler);
+        if (requestFailed && image) {
+            image->f.destroy_image(image);
+            image = NULL;
+        }
+    }
 
 
+    if (image == NULL) {
+        DPRINTF("Window is cringe\n");
+        return ret;
+    }
+    DPRINTF("Got image%s\n", shared ? " (shared)" : "");
+
+    *browser_coords = session->windowCoords;
+
     ret.width = width;
     ret.height = height;
-    ret.pixels = array;
+    ret.shared = shared;
+
+    // The usual layout can be used as it is.
+    if (
+        image->bits_per_pixel == 32
+        && image->byte_order == LSBFirst
+        && image->red_mask == 0xff0000
+        && image->green_mask == 0x00ff00
+        && image->blue_mask == 0x0000ff
+    ) {
+        ret.pixels = (pixel_t *)image->data;
+        ret.stride = image->bytes_per_line / sizeof(pixel_t);
+        ret.owner = image;
+        return ret;
+    }
+
+    // Anything else gets converted.
+    DPRINTF("Converting a %d bit image\n", image->bits_per_pixel);
+    ret.pixels = malloc(width * height * sizeof(pixel_t));
+    ret.stride = width;
+    ret.shared = 0;
+    convertImage(image, ret);
+    if (!shared) image->f.destroy_image(image);
 
     return ret;
 }
 
 
-Window waitForActivation(Window browser) {
-    Display *display = XOpenDisplay(NULL);
+void freeImage(image_t image) {
+    if (image.owner == NULL) free(image.pixels);
+    else if (!image.shared) image.owner->f.destroy_image(image.owner);
+}
 
-    if (browser == 0) {
-        Window root = DefaultRootWindow(display);
-        browser = findBrowser(display, root, 0);
+
+// Makes sure there's a shared image of the right size for the window.
+// Returns 0 if XShm can't be used.
+uint8_t prepareShmImage(session_t *session, uint32_t width, uint32_t height) {
+    if (!session->hasShm) return 0;
+
+    Display *display = session->display;
+    XImage *image = session->shmImage;
+    XShmSegmentInfo *info = &session->shmInfo;
+    if (
+        image
+        && (uint32_t)image->width == width
+        && (uint32_t)image->height == height
+        && (uint32_t)image->depth == session->depth
+    ) return 1;
+
+    releaseShmImage(session);
+
+    image = XShmCreateImage(
+        display, session->visual, session->depth, ZPixmap, NULL, info,
+        width, height
+    );
+    if (image == NULL) {
+        session->hasShm = 0;
+        return 0;
     }
 
-    DPRINTF("Found window. Waiting for activation..\n");
+    info->shmid = shmget(
+        IPC_PRIVATE, image->bytes_per_line * image->height, IPC_CREAT | 0600
+    );
+    if (info->shmid < 0) {
+        image->f.destroy_image(image);
+        session->hasShm = 0;
+        return 0;
+    }
+    info->shmaddr = shmat(info->shmid, NULL, 0);
+    if (info->shmaddr == (void *)-1) {
+        shmctl(info->shmid, IPC_RMID, NULL);
+        image->f.destroy_image(image);
+        session->hasShm = 0;
+        return 0;
+    }
+    image->data = info->shmaddr;
+    info->readOnly = False;
+
+    // This fails on remote displays, which only shows up as an X error.
+    requestFailed = 0;
+    XErrorHandler oldHandler = XSetErrorHandler(catchRequestError);
+    XShmAttach(display, info);
+    XSync(display, False);
+    XSetErrorHandler(oldHandler);
+
+    // The segment goes away by itself once both sides let go of it.
+    shmctl(info->shmid, IPC_RMID, NULL);
+
+    if (requestFailed) {
+        DPRINTF("XShm doesn't work here, capturing the slow way\n");
+        shmdt(info->shmaddr);
+        image->data = NULL;
+        image->f.destroy_image(image);
+        session->hasShm = 0;
+        return 0;
+    }
 
-    XRaiseWindow(display, browser);
+    session->shmImage = image;
+    return 1;
+}
 
-    XSelectInput(display, browser, FocusChangeMask);
-    XEvent event;
-    while (1) {
-        XNextEvent(display, &event);
 
-        if (event.type == FocusIn) {
-            DPRINTF("Window 0x%lx gained focus!\n", browser);
-            XCloseDisplay(display);
-            return browser;
+void releaseShmImage(session_t *session) {
+    if (session->shmImage == NULL) return;
+
+    XShmDetach(session->display, &session->shmInfo);
+    XSync(session->display, False);
+    shmdt(session->shmInfo.shmaddr);
+
+    // The data isn't malloc'd, so XDestroyImage shouldn't free it.
+    session->shmImage->data = NULL;
+    session->shmImage->f.destroy_image(session->shmImage);
+    session->shmImage = NULL;
+}
+
+
+int catchRequestError(Display *display, XErrorEvent *error) {
+    (void)display;
+    (void)error;
+    requestFailed = 1;
+    return 0;
+}
+
+
+// Converts pixels of any other TrueColor layout into BGRX, a row at a time.
+// 16, 24 and 32 bit pixels are read directly, the rest goes through
+// get_pixel (which is slow, but nobody has those anymore).
+void convertImage(XImage *image, image_t converted) {
+    uint32_t shifts[3], bits[3];
+    getChannel(image->red_mask, &shifts[0], &bits[0]);
+    getChannel(image->green_mask, &shifts[1], &bits[1]);
+    getChannel(image->blue_mask, &shifts[2], &bits[2]);
+    const unsigned long masks[3] = {
+        image->red_mask, image->green_mask, image->blue_mask
+    };
+
+    const uint32_t bytes = image->bits_per_pixel / 8;
+    const uint8_t direct = (bytes == 2 || bytes == 3 || bytes == 4)
+        && image->bits_per_pixel % 8 == 0;
+    const uint8_t msbFirst = image->byte_order == MSBFirst;
+
+    for (uint32_t y = 0; y < converted.height; y++) {
+        const uint8_t *row = (uint8_t *)image->data + y * image->bytes_per_line;
+        pixel_t *out = converted.pixels + y * converted.stride;
+
+        for (uint32_t x = 0; x < converted.width; x++) {
+            unsigned long pixel = 0;
+            if (direct) {
+                const uint8_t *p = row + x * bytes;
+                for (uint32_t b = 0; b < bytes; b++) {
+                    const uint32_t shift = msbFirst ? bytes - 1 - b : b;
+                    pixel |= (unsigned long)p[b] << (8 * shift);
+                }
+            }
+            else pixel = image->f.get_pixel(image, x, y);
+
+            // Channels with less than 8 bits get stretched to 0-255.
+            uint8_t channels[3];
+            for (uint32_t c = 0; c < 3; c++) {
+                uint32_t value = (pixel & masks[c]) >> shifts[c];
+                if (bits[c] < 8 && bits[c] > 0) {
+                    value = value * 255 / ((1u << bits[c]) - 1);
+                }
+                else if (bits[c] > 8) value >>= bits[c] - 8;
+                channels[c] = value;
+            }
+
+            out[x] = (pixel_t){
+                .r = channels[0], .g = channels[1], .b = channels[2]
+            };
         }
     }
+}
+
 
+// Where a color channel is in a pixel, and how many bits it has.
+void getChannel(unsigned long mask, uint32_t *shift, uint32_t *bits) {
+    *shift = 0;
+    *bits = 0;
+    if (mask == 0) return;
+
+    while (!(mask & 1)) {
+        mask >>= 1;
+        (*shift)++;
+    }
+    while (mask & 1) {
+        mask >>= 1;
+        (*bits)++;
+    }
 }
 
 
-void imageToFile(const char *fileName, pixel_t *image, uint32_t width, uint32_t height) {
 
-    FILE *file = fopen(fileName, "w");
-    fprintf(file, "P6\n%d\n%d\n255\n", width, height);
 
+Window waitForActivation(session_t *session) {
+    Display *display = session->display;
+    Window browser = session->window;
 
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            fwrite(image[y * width + x].rgb, 1, 3, file);
+    DPRINTF("Found window. Waiting for activation..\n");
+
+    XRaiseWindow(display, browser);
+
+    XSelectInput(display, browser, FocusChangeMask);
+    XEvent event;
+    while (1) {
+        XNextEvent(display, &event);
+
+        if (event.type == FocusIn) {
+            DPRINTF("Window 0x%lx gained focus!\n", browser);
+            // Focus events aren't needed anymore.
+            XSelectInput(display, browser, NoEventMask);
+            return browser;
         }
     }
 
-    fclose(file);
 }
 
 
-Window findBrowser(Display *display, Window root, int depth) {
+Window findBrowser(session_t *session, Window root, int depth) {
+    Display *display = session->display;
     Window idc1, idc2;
     Window *kids;
     uint32_t kidCount = 0;
@@ -171,14 +451,14 @@ Window findBrowser(Display *display, Window root, int depth) {
 
     for (uint32_t i = 0; i < kidCount; i++) {
 
-        if (isBrowser(display, kids[i])) {
+        if (isBrowser(session, kids[i])) {
             Window ret = kids[i];
             XFree(kids);
             return ret;
         }
 
 
-        Window potentialBrowser = findBrowser(display, kids[i], depth + 1);
+        Window potentialBrowser = findBrowser(session, kids[i], depth + 1);
         if (potentialBrowser != 0) {
             XFree(kids);
             return potentialBrowser;
@@ -190,9 +470,9 @@ Window findBrowser(Display *display, Window root, int depth) {
 }
 
 
-uint8_t isBrowser(Display *display, Window window) {
+uint8_t isBrowser(session_t *session, Window window) {
 
-    Atom atom = XInternAtom(display, "WM_WINDOW_ROLE", 1);
+    Atom atom = session->windowRole;
     if (atom == None) return 0;
 
     Atom type;
@@ -202,7 +482,7 @@ uint8_t isBrowser(Display *display, Window window) {
     unsigned char *data;
 
     XGetWindowProperty(
-        display,
+        session->display,
         window,
         atom,
         0, 32, 0,
@@ -379,52 +659,26 @@ void printKids(Display *display, Window *kids, uint32_t kidCount, uint32_t depth
 
 // ============ Acting ============
 
-static Display *actingDisplay;
-
-void initClicking(void) {
-    actingDisplay = XOpenDisplay(NULL);
-}
-
-void stopClicking(void) {
-    XCloseDisplay(actingDisplay);
-}
-
-static void getMouseCoords(int *x, int *y) {
-    XEvent event;
-    XQueryPointer (
-        actingDisplay, DefaultRootWindow (actingDisplay),
-        &event.xbutton.root, &event.xbutton.window,
-        &event.xbutton.x_root, &event.xbutton.y_root,
-        &event.xbutton.x, &event.xbutton.y,
-        &event.xbutton.state
+void moveMouseTo(session_t *session, int x, int y) {
+    XWarpPointer(
+        session->display, None, session->root, 0, 0, 0, 0, x, y
     );
-    *x = event.xbutton.x;
-    *y = event.xbutton.y;
-}
-
-
-void moveMouseTo(int x, int y) {
-    int cur_x, cur_y;
-    getMouseCoords(&cur_x, &cur_y);
-    usleep (1);
-    XWarpPointer(actingDisplay, None, None, 0,0,0,0, x - cur_x, y - cur_y);
+    XFlush(session->display);
     usleep (1);
 }
 
 
-void clickMouse(void) {
-    XTestFakeButtonEvent(actingDisplay, Button1, True, CurrentTime);
+void clickMouse(session_t *session) {
+    XTestFakeButtonEvent(session->display, Button1, True, CurrentTime);
+    XFlush(session->display);
     usleep (1);
-    XTestFakeButtonEvent(actingDisplay, Button1, False, CurrentTime);
+    XTestFakeButtonEvent(session->display, Button1, False, CurrentTime);
+    XFlush(session->display);
 }
 
 
-void doubleClickMouse(void) {
-    XTestFakeButtonEvent(actingDisplay, Button1, True, CurrentTime);
-    usleep (1);
-    XTestFakeButtonEvent(actingDisplay, Button1, False, CurrentTime);
+void doubleClickMouse(session_t *session) {
+    clickMouse(session);
     usleep (10);
-    XTestFakeButtonEvent(actingDisplay, Button1, True, CurrentTime);
-    usleep (1);
-    XTestFakeButtonEvent(actingDisplay, Button1, False, CurrentTime);
-}
\ No newline at end of file
+    clickMouse(session);
+}
@@ -3,25 +3,36 @@
 
 #include <X11/X.h>
 #include <X11/Xlib.h>
+#include <X11/extensions/XShm.h>
 
 #include <stdint.h>
 
 
+// Laid out like the 32-bit pixels of pretty much every X server (BGRX),
+// so images can point straight into what X gives us.
 typedef struct {
     union {
         struct {
-            uint8_t r;
-            uint8_t g;
             uint8_t b;
+            uint8_t g;
+            uint8_t r;
+            uint8_t x;
         };
-        uint8_t rgb[3];
+        uint32_t value;
     };
 } pixel_t;
 
 typedef struct {
     uint32_t width;
     uint32_t height;
+    // The amount of pixels from one row to the next.
+    uint32_t stride;
     pixel_t *pixels;
+
+    // The XImage the pixels are in, or NULL if they were malloc'd.
+    XImage *owner;
+    // Whether that's the session's shared image, which gets reused.
+    uint8_t shared;
 } image_t;
 
 
@@ -30,28 +41,77 @@ typedef struct {
     int32_t y;
 } coord_t;
 
+typedef struct {
+    int32_t x;
+    int32_t y;
+    uint32_t width;
+    uint32_t height;
+} rect_t;
+
+
 
+// One connection to the X server, for waiting, capturing and clicking.
+// Everything that doesn't change gets looked up once, when it's opened.
+typedef struct {
+    Display *display;
+    Window root;
+    // The browser window.
+    Window window;
+
+    // Where the window is on the screen, and how big it is.
+    // Updated on every capture of the whole window.
+    coord_t windowCoords;
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+    Visual *visual;
+
+    Atom windowRole;
+    uint8_t hasShm;
+    uint8_t hasXTest;
+    uint8_t hasDamage;
+    // Where the XDamage events start.
+    int damageEvents;
+
+    // Kept around between captures, so the shared memory (XShm)
+    // only gets set up again when the size changes.
+    XImage *shmImage;
+    XShmSegmentInfo shmInfo;
+} session_t;
+
+
+// Session
+// Opens the display and finds the browser window,
+// or uses the given window if it isn't 0.
+// Returns -1 if either can't be done.
+int openSession(session_t *session, Window window);
+// Should be run when done with the session.
+// Images from it can't be used after this.
+void closeSession(session_t *session);
 
 // Looking
-Window findBrowser(Display *display, Window root, int depth);
+Window findBrowser(session_t *session, Window root, int depth);
 
 // Gets an image of the browser window.
-// If browser == 0 it will try to find it by itself (using findBrowser).
-image_t getBrowserWindow(Window browser, coord_t *browser_coords);
-void imageToFile(
-    const char *fileName, pixel_t *image, uint32_t width, uint32_t height
+// Uses shared memory (XShm) when it can, so the image is only good
+// until the next capture.
+image_t getBrowserWindow(session_t *session, coord_t *browser_coords);
+// Same, but only the region of the window (in window coordinates).
+// The region gets clipped to the window. Gives an empty image
+// (pixels == NULL) if none of it is in the window.
+image_t getBrowserRegion(
+    session_t *session, rect_t *region, coord_t *browser_coords
 );
+// Frees an image from getBrowserWindow.
+// The shared image stays around for the next capture.
+void freeImage(image_t image);
 
 // Acting
-// Initializes clicking (gets a display pointer and stores it in a static).
-void initClicking(void);
-// Should always be run after all necessary clicking has been completed.
-void stopClicking(void);
-void moveMouseTo(int x, int y);
-void clickMouse(void);
-void doubleClickMouse(void);
-
-Window waitForActivation(Window browser);
+void moveMouseTo(session_t *session, int x, int y);
+void clickMouse(session_t *session);
+void doubleClickMouse(session_t *session);
+
+Window waitForActivation(session_t *session);
     
 
 #endif
@@ -1,14 +1,24 @@
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <getopt.h>
 
+#include "batch.h"
 #include "clicker.h"
+#include "convert.h"
+#include "corpus.h"
 #include "looker.h"
+#include "monitor.h"
 #include "reader.h"
 #include "seeer.h"
+#include "serve.h"
 #include "solver.h"
+#include "tuning.h"
 #include "types.h"
+#include "viewer.h"
 
 
 #define S(s) S_LAYER(s)
@@ -16,6 +26,29 @@
 
 void printHelp(char *executable);
 void printFileHelp(void);
+static int printSolution(board_t board, solveStats_t stats);
+static int solveCorpus(FILE *file, solveOptions_t *options);
+
+
+// Codes for the options that only have a long version.
+enum {
+    OPTION_BATCH = 256,
+    OPTION_CHECKPOINT,
+    OPTION_CHECKPOINT_INTERVAL,
+    OPTION_CONVERT,
+    OPTION_CORPUS,
+    OPTION_DETECTOR,
+    OPTION_IMAGE,
+    OPTION_IMAGE_DIR,
+    OPTION_MONITOR,
+    OPTION_ORDER,
+    OPTION_RESUME,
+    OPTION_SERVE,
+    OPTION_STRATEGY,
+    OPTION_THREADS,
+    OPTION_TUNING_FILE,
+    OPTION_WITH_SOLUTIONS,
+};
 
 
 int main(int argc, char *argv[]) {
@@ -30,8 +63,25 @@ int main(int argc, char *argv[]) {
         {"no-solve", no_argument, 0, 's'},
         {"export-image", no_argument, 0, 'e'},
         {"max-attempts", required_argument, 0, 'm'},
+        {"ignore-marks", no_argument, 0, 'i'},
         {"help", no_argument, 0, 'h'},
         {"help-file", no_argument, 0, '*'},
+        {"batch", required_argument, 0, OPTION_BATCH},
+        {"checkpoint", required_argument, 0, OPTION_CHECKPOINT},
+        {"checkpoint-interval", required_argument, 0, OPTION_CHECKPOINT_INTERVAL},
+        {"convert", required_argument, 0, OPTION_CONVERT},
+        {"corpus", required_argument, 0, OPTION_CORPUS},
+        {"detector", required_argument, 0, OPTION_DETECTOR},
+        {"image", required_argument, 0, OPTION_IMAGE},
+        {"image-dir", required_argument, 0, OPTION_IMAGE_DIR},
+        {"monitor", no_argument, 0, OPTION_MONITOR},
+        {"order", required_argument, 0, OPTION_ORDER},
+        {"resume", required_argument, 0, OPTION_RESUME},
+        {"serve", required_argument, 0, OPTION_SERVE},
+        {"strategy", required_argument, 0, OPTION_STRATEGY},
+        {"threads", required_argument, 0, OPTION_THREADS},
+        {"tuning-file", required_argument, 0, OPTION_TUNING_FILE},
+        {"with-solutions", no_argument, 0, OPTION_WITH_SOLUTIONS},
         {0, 0, 0, 0}
     };
 
@@ -41,14 +91,30 @@ int main(int argc, char *argv[]) {
     uint8_t dont_click_solve = 0;
     uint8_t dont_wait = 0;
     uint8_t dont_solve = 0;
+    uint8_t ignore_marks = 0;
     int32_t max_attempts = 0;
-    uint32_t crossing_offset = 5;
+    detectOptions_t detect_options = {
+        .detector = DETECTOR_CROSSINGS, .crossingOffset = 5
+    };
     FILE *file = NULL;
+    FILE *corpus = NULL;
+    const char *convert_path = NULL;
+    uint8_t with_solutions = 0;
+    const char *batch_path = NULL;
+    batchOptions_t batch_options = {.order = ORDER_INPUT};
+    const char *serve_path = NULL;
+    uint8_t monitor_mode = 0;
+    const char *image_path = NULL;
+    const char *image_dir = NULL;
+    const char *resume_path = NULL;
+    solveOptions_t solve_options = {.strategy = STRATEGY_ADAPTIVE};
+    // Only kept between runs when asked to.
+    const char *tuning_path = NULL;
 
     while (1) {
         int option_index = 0;
 
-        int opt = getopt_long(argc, argv, "f:w:d:c:nWsmhe", long_options, &option_index);
+        int opt = getopt_long(argc, argv, "f:w:d:c:nWsmhei", long_options, &option_index);
         if (opt == -1) {
             break;
         }
@@ -71,6 +137,10 @@ int main(int argc, char *argv[]) {
                 dont_solve = 1;
                 break;
 
+            case 'i':
+                ignore_marks = 1;
+                break;
+
             case 'f':
                 file = fopen(optarg, "r");
                 if (file == NULL) {
@@ -91,8 +161,8 @@ int main(int argc, char *argv[]) {
                 break;
 
             case 'c':
-                crossing_offset = strtol(optarg, NULL, 0);
-                if (click_delay == 0) {
+                detect_options.crossingOffset = strtol(optarg, NULL, 0);
+                if (detect_options.crossingOffset == 0) {
                     fprintf(stderr,
                         "Could not parse crossing offset.\n"
                         "A crossing offset of 0 doesn't work.\n"
@@ -121,6 +191,112 @@ int main(int argc, char *argv[]) {
                 printFileHelp();
                 return 0;
 
+            case OPTION_BATCH:
+                batch_path = optarg;
+                break;
+
+            case OPTION_CHECKPOINT:
+                solve_options.checkpointPath = optarg;
+                break;
+
+            case OPTION_CHECKPOINT_INTERVAL:
+                solve_options.checkpointInterval = strtol(optarg, NULL, 0);
+                if (solve_options.checkpointInterval == 0) {
+                    fprintf(stderr, "Could not parse checkpoint interval.\n");
+                    return -1;
+                }
+                break;
+
+            case OPTION_CONVERT:
+                convert_path = optarg;
+                break;
+
+            case OPTION_CORPUS:
+                corpus = fopen(optarg, "r");
+                if (corpus == NULL) {
+                    fprintf(stderr, "Corpus %s not found.\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case OPTION_DETECTOR:
+                if (strcmp(optarg, "crossings") == 0) {
+                    detect_options.detector = DETECTOR_CROSSINGS;
+                }
+                else if (strcmp(optarg, "projection") == 0) {
+                    detect_options.detector = DETECTOR_PROJECTION;
+                }
+                else {
+                    fprintf(stderr, "Unknown detector %s.\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case OPTION_IMAGE:
+                image_path = optarg;
+                break;
+
+            case OPTION_IMAGE_DIR:
+                image_dir = optarg;
+                break;
+
+            case OPTION_MONITOR:
+                monitor_mode = 1;
+                break;
+
+            case OPTION_ORDER:
+                if (strcmp(optarg, "input") == 0) {
+                    batch_options.order = ORDER_INPUT;
+                }
+                else if (strcmp(optarg, "completion") == 0) {
+                    batch_options.order = ORDER_COMPLETION;
+                }
+                else {
+                    fprintf(stderr, "Unknown order %s.\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case OPTION_RESUME:
+                resume_path = optarg;
+                break;
+
+            case OPTION_SERVE:
+                serve_path = optarg;
+                break;
+
+            case OPTION_STRATEGY:
+                if (strcmp(optarg, "propagate") == 0) {
+                    solve_options.strategy = STRATEGY_PROPAGATE;
+                }
+                else if (strcmp(optarg, "search") == 0) {
+                    solve_options.strategy = STRATEGY_SEARCH;
+                }
+                else if (strcmp(optarg, "adaptive") == 0) {
+                    solve_options.strategy = STRATEGY_ADAPTIVE;
+                }
+                else {
+                    fprintf(stderr, "Unknown strategy %s.\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case OPTION_THREADS:
+                batch_options.threads = strtol(optarg, NULL, 0);
+                if (batch_options.threads == 0) {
+                    fprintf(stderr, "Could not parse thread count.\n");
+                    return -1;
+                }
+                break;
+
+            case OPTION_TUNING_FILE:
+                tuning_path = optarg;
+                break;
+
+            case OPTION_WITH_SOLUTIONS:
+                with_solutions = 1;
+                break;
+
 
             default:
                 fprintf(stderr, "getopt returned character code 0x%x??\n", opt);
@@ -129,39 +305,147 @@ int main(int argc, char *argv[]) {
 
     board_t board;
     boardScreenInfo_t screenInfo = {0};
+    solveStats_t stats;
 
-    // Automatic board detection
-    if (file == NULL) {
+    // What the adaptive strategy learned from earlier boards.
+    if (solve_options.strategy == STRATEGY_ADAPTIVE) {
+        loadTuning(tuning_path);
+    }
 
-        if (!dont_wait) {
-            input_window = waitForActivation(input_window);
+    // Continuing a search from a checkpoint.
+    if (resume_path) {
+        printf("Resuming %s\n", resume_path);
+        board = resumeSolve(resume_path, &solve_options, &stats);
+        saveTuning(tuning_path);
+        return printSolution(board, stats);
+    }
+
+    // Turning text boards into binary ones, or the other way around.
+    if (convert_path) {
+        FILE *in = corpus ? corpus : file;
+        if (in == NULL) {
+            fprintf(stderr, "--convert needs a board file or a corpus.\n");
+            return -1;
         }
 
-        uint32_t size = 0;
+        FILE *out = fopen(convert_path, "wb");
+        if (out == NULL) {
+            fprintf(stderr, "Couldn't open %s.\n", convert_path);
+            fclose(in);
+            return -1;
+        }
+
+        int ret = convertCorpus(
+            in, out, with_solutions ? &solve_options : NULL
+        );
+        fclose(in);
+        if (fclose(out)) ret = -1;
+        saveTuning(tuning_path);
+        return ret;
+    }
+
+    // Boards coming in over a socket, until we're told to stop.
+    if (serve_path) {
+        serveOptions_t serve_options = {
+            .threads = batch_options.threads,
+            .solve = solve_options,
+        };
+        int ret = serve(serve_path, &serve_options);
+        saveTuning(tuning_path);
+        return ret;
+    }
 
-        image_t image;
+    // Lots of boards, on lots of threads.
+    if (batch_path) {
+        batch_options.solve = solve_options;
+        int ret = solveBatch(batch_path, &batch_options);
+        saveTuning(tuning_path);
+        return ret;
+    }
+
+    // A whole bunch of boards from one file.
+    if (corpus) {
+        int ret = solveCorpus(corpus, &solve_options);
+        fclose(corpus);
+        saveTuning(tuning_path);
+        return ret;
+    }
+
+    // How well detection does on a bunch of screenshots.
+    if (image_dir) {
+        return detectImageDir(image_dir, &detect_options);
+    }
+
+    // A board from a screenshot instead of the screen.
+    if (image_path) {
         uint32_t *colors;
-        for (uint32_t i = 0; i < max_attempts || max_attempts == 0; i++) {
-            //* Finding the browser window.
-            if (input_window) printf("Using your window: %lx\n", input_window);
+        uint8_t *marks;
+        double ms;
+        uint32_t size = detectImage(
+            image_path, &colors, &marks, &screenInfo, &detect_options, &ms
+        );
+        if (size == 0) {
+            fprintf(stderr, "Could not detect a board in %s.\n", image_path);
+            return -1;
+        }
+        printf("Detected in %.2f ms.\n", ms);
 
-            coord_t browser_coords;
-            image = getBrowserWindow(input_window, &browser_coords);
+        board = createBoard(size);
+        colorBoard(board, colors);
+        free(colors);
+        free(marks);
 
-            size = detectBoard(image, &colors, &screenInfo, crossing_offset);
-            screenInfo.x += browser_coords.x;
-            screenInfo.y += browser_coords.y;
+        if (dont_solve) {
+            printf("Detected this board:\n");
+            printBoard(board, 0);
+            freeBoard(board);
+            return 0;
+        }
+        printf("Solving this board:\n");
+        printBoard(board, 0);
+        printf("\n");
 
-            if (export_image) {
-                imageToFile(
-                    "img/export.ppm", image.pixels, image.width, image.height
-                );
-            }
+        board = solveWith(board, &solve_options, &stats);
+        saveTuning(tuning_path);
+        return printSolution(board, stats);
+    }
 
-            if (size) break;
+    // Automatic board detection
+    if (file == NULL) {
 
+        session_t session;
+        if (openSession(&session, input_window)) return -1;
+        if (input_window) printf("Using your window: %lx\n", input_window);
 
-            free(image.pixels);
+        if (!dont_wait) {
+            waitForActivation(&session);
+        }
+
+        if (monitor_mode) {
+            monitorOptions_t monitor_options = {
+                .solve = solve_options,
+                .clickDelay = click_delay,
+                .detect = detect_options,
+                .ignoreMarks = ignore_marks,
+                .dontClick = dont_click_solve,
+            };
+            int ret = monitor(&session, &monitor_options);
+            closeSession(&session);
+            saveTuning(tuning_path);
+            return ret;
+        }
+
+        uint32_t size = 0;
+
+        uint32_t *colors;
+        uint8_t *marks;
+        boardScreenInfo_t locked = {0};
+        for (uint32_t i = 0; i < max_attempts || max_attempts == 0; i++) {
+            size = captureBoard(
+                &session, &locked, &screenInfo, &colors, &marks,
+                &detect_options, export_image
+            );
+            if (size) break;
         }
 
 
@@ -170,37 +454,51 @@ int main(int argc, char *argv[]) {
                 "Could not detect a valid board within %d attempts.",
                 max_attempts
             );
+            closeSession(&session);
             return -1;
         }
 
 
 
-        // Create and color the board.
-        board = createBoard(size);
-        colorBoard(board, colors);
+        // Create and color the board,
+        // starting from whatever was already put on it.
+        uint8_t seeded;
+        board = createDetectedBoard(size, colors, marks, ignore_marks, &seeded);
+
         if (dont_solve) {
             printf("Detected this board:\n");
             printBoard(board, 0);
-            free(image.pixels);
             free(colors);
+            free(marks);
             freeBoard(board);
+            closeSession(&session);
             return 0;
         }
         printf("Solving this board:\n");
         printBoard(board, 0);
         printf("\n");
 
-        free(image.pixels);
+        // Solve the board.
+        board = solveDetected(board, colors, seeded, &solve_options, &stats);
         free(colors);
+        saveTuning(tuning_path);
 
-        // Solve the board.
-        board = solve(board);
+        if (board.size == 0) {
+            fprintf(stderr, "This board can't be solved.\n");
+            free(marks);
+            closeSession(&session);
+            return -1;
+        }
 
         printf("\nSolved!\n");
         if (!dont_click_solve) {
             printf("Clicking..\n");
-            clickSolveBoard(board, screenInfo, click_delay);
+            clickSolveBoard(
+                &session, board, screenInfo, click_delay, marks
+            );
         }
+        free(marks);
+        closeSession(&session);
 
         printf("The board:\n");
         printBoard(board, 0);
@@ -212,29 +510,98 @@ int main(int argc, char *argv[]) {
     // File reading
     else {
 
-        uint32_t size = 0;
-
         if (file == NULL) {
             fprintf(stderr, "Your stupid file doesn't exist nerd.\n");
             return -1;
         }
 
         //* Reading file
-        if (measureQueensFile(file, &size)) {
-            fprintf(stderr, "Something went wrong while measuring the file.\n");
+        if (readQueensFile(file, &board)) {
+            fprintf(stderr, "Reading the board went wrong somehow whoops\n");
+            fclose(file);
             return -1;
         }
-        printf("Size: %d\n", size);
+        printf("Size: %d\n", board.size);
+        fclose(file);
 
-        board = createBoard(size);
+        printf("Solving this board:\n");
+        printBoard(board, 0);
+        printf("\n");
 
-        fseek(file, 0, SEEK_SET);
-        if (readQueensFile(file, &board)) {
-            fprintf(stderr, "Reading the board went wrong somehow whoops\n");
-            freeBoard(board);
-            return -1;
+        board = solveWith(board, &solve_options, &stats);
+        saveTuning(tuning_path);
+        return printSolution(board, stats);
+    }
+}
+
+
+// Prints (and frees) a board solved from a file or a checkpoint.
+int printSolution(board_t board, solveStats_t stats) {
+    if (board.size == 0) {
+        fprintf(stderr, "This board can't be solved.\n");
+        return -1;
+    }
+
+    printf(
+        "Solved in %" PRIu64 " ms (%" PRIu64 " passes, tried %" PRIu64 " queens):\n",
+        stats.elapsedMs, stats.passes, stats.nodes
+    );
+    printBoard(board, 0);
+    printf("\n");
+
+    freeBoard(board);
+    return 0;
+}
+
+
+// Solves every board in a corpus, printing a line per board:
+// its ID and the column of the queen on every row.
+int solveCorpus(FILE *file, solveOptions_t *options) {
+    corpus_t corpus;
+    if (openCorpus(file, &corpus)) return -1;
+
+    uint32_t solved = 0;
+    puzzleView_t puzzle;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (nextPuzzle(&corpus, &puzzle)) {
+        if (puzzle.id) printf("%.*s:", puzzle.idLength, puzzle.id);
+        else printf("%u:", puzzle.index);
+
+        board_t board;
+        if (readPuzzle(&puzzle, &board, NULL)) {
+            printf(" invalid\n");
+            continue;
         }
+
+        solveStats_t stats;
+        board = solveWith(board, options, &stats);
+        if (board.size == 0) {
+            printf(" unsolvable\n");
+            continue;
+        }
+
+        uint8_t solution[board.size];
+        getSolution(board, solution);
+        for (uint32_t y = 0; y < board.size; y++) {
+            printf(" %u", solution[y]);
+        }
+        printf("\n");
+
+        freeBoard(board);
+        solved++;
     }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Solved %u of %u boards in %ld ms.\n", solved, corpus.count,
+        (long)(end.tv_sec - start.tv_sec) * 1000
+        + (end.tv_nsec - start.tv_nsec) / 1000000
+    );
+
+    closeCorpus(&corpus);
+    return solved == corpus.count ? 0 : -1;
 }
 
 
@@ -255,6 +622,38 @@ void printHelp(char *executable) {
 
         "  -f, --file=FILE      Read the board from FILE instead of the screen.\n"
         "                       For the board file format use --help-file.\n"
+        "      --corpus=FILE    Solve every board in FILE, and print the solutions.\n"
+        "                       For the corpus format use --help-file.\n"
+        "      --batch=PATH     Solve every board in corpus PATH (or in every file in\n"
+        "                       directory PATH) on multiple threads. Prints a line of\n"
+        "                       JSON for every board, and some statistics at the end.\n"
+        "      --serve=SOCKET   Solve boards sent to unix socket SOCKET, until stopped\n"
+        "                       with ctrl+c. Boards are text (ending with a blank line)\n"
+        "                       or binary, and every board gets a line of JSON back.\n"
+        "                       tools/queens-client can send them.\n"
+        "      --threads=THREADS\n"
+        "                       How many threads --batch and --serve use.\n"
+        "                       Default is one for every processor.\n"
+        "      --order=ORDER    \"input\" (the default) prints the --batch results in\n"
+        "                       the same order as the boards, \"completion\" prints\n"
+        "                       them as soon as they're done.\n"
+        "      --convert=OUT    Write the boards from -f or --corpus to OUT as binary\n"
+        "                       boards, or as text if they already were binary.\n"
+        "                       (Board IDs don't make it into binary files.)\n"
+        "      --with-solutions Solve the boards while converting them,\n"
+        "                       and store the solutions with them.\n"
+        "      --monitor        Keep watching the window, and solve every new board\n"
+        "                       that shows up, until stopped with ctrl+c.\n"
+        "      --detector=DETECTOR\n"
+        "                       How to find the board: \"crossings\" (the default)\n"
+        "                       looks for where the lines of the grid cross,\n"
+        "                       \"projection\" for rows and columns with long black\n"
+        "                       lines in them.\n"
+        "      --image=FILE     Detect the board in screenshot FILE (a PPM image, like\n"
+        "                       --export-image makes) instead of on the screen.\n"
+        "      --image-dir=DIR  Detect the boards in every PPM image in DIR, and print\n"
+        "                       how long that took. Images with a board file next to\n"
+        "                       them (NAME.txt for NAME.ppm) have to have that board.\n"
         "  -d, --delay=DELAY    The delay between clicks in us.\n"
         "                       Some websites need longer delays.\n"
         "  -n, --no-click       Don't take control of the mouse, just print the solution.\n"
@@ -266,6 +665,25 @@ void printHelp(char *executable) {
         "                       Attempt to detect a board a maximum of ATTEMPTS times.\n"
         "                       Default is 0 (no limit).\n"
         "  -W, --no-wait        Don't wait for window activation.\n"
+        "  -i, --ignore-marks   Ignore the queens and crosses that are already on the\n"
+        "                       board, instead of solving from there.\n"
+        "      --checkpoint=FILE\n"
+        "                       Save the progress of long searches to FILE,\n"
+        "                       so they can be resumed with --resume.\n"
+        "      --checkpoint-interval=SECONDS\n"
+        "                       How often to save a checkpoint. Default is "
+        S(DEFAULT_CHECKPOINT_INTERVAL) ".\n"
+        "      --resume=FILE    Continue the search saved in checkpoint FILE.\n"
+        "                       Keeps saving to FILE unless --checkpoint is given.\n"
+        "      --strategy=STRATEGY\n"
+        "                       How to solve: \"propagate\" uses the quick methods\n"
+        "                       until they stop working, \"search\" bruteforces right\n"
+        "                       away, and \"adaptive\" (the default) switches between\n"
+        "                       them based on what was cheaper for earlier boards.\n"
+        "      --tuning-file=FILE\n"
+        "                       Keep what the adaptive strategy learned in FILE\n"
+        "                       (like ~/" TUNING_FILE "), and start from it next\n"
+        "                       time. Otherwise it's forgotten when the program ends.\n"
         "  -h, --help           Display this help and exit\n\n"
         "      --help-file      Display a help text about the file format for the -f option.\n\n"
 
@@ -301,6 +719,21 @@ void printFileHelp(void) {
 
         "But the following file also does:\n"
         "  red red red red red red red 2 red & blue 2 2 & &\n"
-        "  blue e e & & blue e e & &\n"
+        "  blue e e & & blue e e & &\n\n\n"
+
+        "A corpus file (for --corpus) holds any amount of boards.\n"
+        "Boards are separated by blank lines, and can have an ID on a line\n"
+        "starting with # right before them. A line like \"# solution 3 1 4 2 0\"\n"
+        "in the same place has the column of the queen on every row.\n"
+        "Other lines starting with # are ignored.\n\n"
+
+        "Example:\n"
+        "  # first board\n"
+        "  # solution 3 1 4 2 0\n"
+        "  (the first board)\n\n"
+        "  # second board\n"
+        "  (the second board)\n\n\n"
+
+        "Both -f and --corpus also take the binary files made by --convert.\n"
     );
 }
\ No newline at end of file
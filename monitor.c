@@ -0,0 +1,221 @@
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <X11/Xlib.h>
+#include <X11/extensions/Xdamage.h>
+
+#include "clicker.h"
+#include "looker.h"
+#include "monitor.h"
+#include "seeer.h"
+#include "solver.h"
+#include "types.h"
+
+
+typedef struct {
+    session_t *session;
+    monitorOptions_t *options;
+    Damage damage;
+
+    // Where the board was last time, see captureBoard.
+    boardScreenInfo_t locked;
+    // Of the last capture, without XDamage.
+    uint64_t frameHash;
+
+    // The last board that was seen, so it doesn't get solved again
+    // when the queens we clicked show up.
+    uint32_t *lastColors;
+    uint32_t lastSize;
+    uint32_t solved;
+} monitor_t;
+
+
+static void lookAtWindow(monitor_t *monitor);
+static uint8_t waitForDamage(monitor_t *monitor);
+static uint8_t waitForNewFrame(monitor_t *monitor);
+static uint64_t hashFrame(image_t image);
+static void handleStop(int signal);
+
+
+static volatile sig_atomic_t stopRequested;
+
+
+int monitor(session_t *session, monitorOptions_t *options) {
+    monitor_t monitor = {
+        .session = session,
+        .options = options,
+    };
+
+    // No SA_RESTART, so poll gets interrupted.
+    stopRequested = 0;
+    struct sigaction stop = {.sa_handler = handleStop};
+    sigemptyset(&stop.sa_mask);
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+
+    if (session->hasDamage) {
+        monitor.damage = XDamageCreate(
+            session->display, session->window, XDamageReportNonEmpty
+        );
+        printf("Watching the window for new boards.\n");
+    }
+    else {
+        printf("No XDamage, checking the window every %d ms.\n",
+            MONITOR_POLL_MS
+        );
+    }
+
+    // There might already be one.
+    do {
+        lookAtWindow(&monitor);
+    } while (
+        session->hasDamage ? waitForDamage(&monitor) : waitForNewFrame(&monitor)
+    );
+
+    if (session->hasDamage) XDamageDestroy(session->display, monitor.damage);
+    free(monitor.lastColors);
+
+    printf("\nStopped watching, solved %u boards.\n", monitor.solved);
+    return 0;
+}
+
+
+void lookAtWindow(monitor_t *monitor) {
+    monitorOptions_t *options = monitor->options;
+
+    boardScreenInfo_t screenInfo;
+    uint32_t *colors;
+    uint8_t *marks;
+    const uint32_t size = captureBoard(
+        monitor->session, &monitor->locked, &screenInfo, &colors, &marks,
+        &options->detect, 0
+    );
+    if (size == 0) return;
+
+    if (
+        size == monitor->lastSize
+        && memcmp(colors, monitor->lastColors, size * size * sizeof(uint32_t)) == 0
+    ) {
+        free(colors);
+        free(marks);
+        return;
+    }
+    free(monitor->lastColors);
+    monitor->lastColors = colors;
+    monitor->lastSize = size;
+
+    printf("New %ux%u board!\n", size, size);
+    solveStats_t stats;
+    uint8_t seeded;
+    board_t board = createDetectedBoard(
+        size, colors, marks, options->ignoreMarks, &seeded
+    );
+    board = solveDetected(board, colors, seeded, &options->solve, &stats);
+    if (board.size == 0) {
+        fprintf(stderr, "This board can't be solved.\n");
+        free(marks);
+        return;
+    }
+    printf("Solved in %" PRIu64 " ms.\n", stats.elapsedMs);
+    monitor->solved++;
+
+    if (!options->dontClick) {
+        clickSolveBoard(
+            monitor->session, board, screenInfo, options->clickDelay, marks
+        );
+    }
+    printBoard(board, 0);
+    printf("\n");
+
+    freeBoard(board);
+    free(marks);
+}
+
+
+// Sleeps until the window changed and then stayed the same for a bit.
+// Returns 0 when it's time to stop.
+uint8_t waitForDamage(monitor_t *monitor) {
+    Display *display = monitor->session->display;
+    uint8_t changed = 0;
+
+    while (!stopRequested) {
+        // Nothing happens until the window changes, and once it did,
+        // it only has to stop changing.
+        if (!XPending(display)) {
+            struct pollfd connection = {
+                .fd = ConnectionNumber(display), .events = POLLIN
+            };
+            const int ready = poll(
+                &connection, 1, changed ? MONITOR_SETTLE_MS : -1
+            );
+            if (ready == 0) return 1;
+            if (ready < 0) continue;
+        }
+
+        while (XPending(display)) {
+            XEvent event;
+            XNextEvent(display, &event);
+            if (event.type == monitor->session->damageEvents + XDamageNotify) {
+                changed = 1;
+            }
+        }
+
+        // Otherwise there won't be another event for the next change.
+        if (changed) XDamageSubtract(display, monitor->damage, None, None);
+    }
+
+    return 0;
+}
+
+
+// Same, without XDamage: captures the window every MONITOR_POLL_MS,
+// until one capture looks different and the next one looks the same.
+uint8_t waitForNewFrame(monitor_t *monitor) {
+    uint8_t changed = 0;
+
+    while (!stopRequested) {
+        usleep(MONITOR_POLL_MS * 1000);
+        if (stopRequested) break;
+
+        coord_t browser_coords;
+        image_t image = getBrowserWindow(monitor->session, &browser_coords);
+        if (image.pixels == NULL) continue;
+        const uint64_t hash = hashFrame(image);
+        freeImage(image);
+
+        if (hash != monitor->frameHash) {
+            monitor->frameHash = hash;
+            changed = 1;
+        }
+        else if (changed) return 1;
+    }
+
+    return 0;
+}
+
+
+// FNV-1a over every 4th pixel of every 4th row, which is plenty to notice
+// a board showing up.
+uint64_t hashFrame(image_t image) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (uint32_t y = 0; y < image.height; y += 4) {
+        const pixel_t *row = image.pixels + y * image.stride;
+        for (uint32_t x = 0; x < image.width; x += 4) {
+            hash ^= row[x].value & 0xffffff;
+            hash *= 0x100000001b3;
+        }
+    }
+    return hash;
+}
+
+
+void handleStop(int signal) {
+    (void)signal;
+    stopRequested = 1;
+}
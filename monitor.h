@@ -0,0 +1,35 @@
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <stdint.h>
+
+#include "looker.h"
+#include "seeer.h"
+#include "solver.h"
+
+
+// How long the window has to stay the same before it gets looked at,
+// so boards are detected once they're done appearing, not halfway.
+#define MONITOR_SETTLE_MS 30
+
+// Without XDamage, the window gets captured this often to see if it changed.
+#define MONITOR_POLL_MS 100
+
+
+typedef struct {
+    solveOptions_t solve;
+    uint32_t clickDelay;
+    detectOptions_t detect;
+    uint8_t ignoreMarks;
+    uint8_t dontClick;
+} monitorOptions_t;
+
+
+// Keeps watching the window, and solves (and clicks) every new board
+// that shows up on it, until it gets SIGINT or SIGTERM.
+// Only looks for a board when something in the window changed:
+// it waits for XDamage events, or compares captures if there's no XDamage.
+int monitor(session_t *session, monitorOptions_t *options);
+
+
+#endif // MONITOR_H
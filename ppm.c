@@ -0,0 +1,119 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "looker.h"
+#include "ppm.h"
+
+
+// Bigger images from a file are probably broken,
+// and their pixels wouldn't fit in memory anyway.
+#define MAX_FILE_IMAGE_SIZE 16384
+
+
+static int readPpmNumber(FILE *file, uint32_t *number);
+
+
+void imageToFile(const char *fileName, image_t image) {
+
+    FILE *file = fopen(fileName, "w");
+    fprintf(file, "P6\n%d\n%d\n255\n", image.width, image.height);
+
+
+    for (uint32_t y = 0; y < image.height; y++) {
+        for (uint32_t x = 0; x < image.width; x++) {
+            pixel_t pixel = image.pixels[y * image.stride + x];
+            uint8_t rgb[3] = {pixel.r, pixel.g, pixel.b};
+            fwrite(rgb, 1, 3, file);
+        }
+    }
+
+    fclose(file);
+}
+
+
+int imageFromFile(const char *fileName, image_t *image) {
+    FILE *file = fopen(fileName, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Image %s not found.\n", fileName);
+        return -1;
+    }
+
+    uint32_t width, height, maxValue;
+    if (
+        fgetc(file) != 'P' || fgetc(file) != '6'
+        || readPpmNumber(file, &width) || readPpmNumber(file, &height)
+        || readPpmNumber(file, &maxValue)
+        || width == 0 || height == 0 || maxValue != 255
+    ) {
+        fprintf(stderr, "%s isn't a PPM image with 8 bit colors.\n", fileName);
+        fclose(file);
+        return -1;
+    }
+    if (width > MAX_FILE_IMAGE_SIZE || height > MAX_FILE_IMAGE_SIZE) {
+        fprintf(stderr, "%s is too big (%ux%u).\n", fileName, width, height);
+        fclose(file);
+        return -1;
+    }
+
+    *image = (image_t){
+        .width = width,
+        .height = height,
+        .stride = width,
+        .pixels = malloc((size_t)width * height * sizeof(pixel_t)),
+    };
+
+    // A row at a time, spread out into pixels.
+    uint8_t *row = malloc((size_t)width * 3);
+    if (image->pixels == NULL || row == NULL) {
+        fprintf(stderr, "Not enough memory for %s.\n", fileName);
+        free(row);
+        free(image->pixels);
+        fclose(file);
+        return -1;
+    }
+    for (uint32_t y = 0; y < height; y++) {
+        if (fread(row, 3, width, file) != width) {
+            fprintf(stderr, "%s ends too early.\n", fileName);
+            free(row);
+            free(image->pixels);
+            fclose(file);
+            return -1;
+        }
+
+        pixel_t *pixels = image->pixels + y * image->stride;
+        for (uint32_t x = 0; x < width; x++) {
+            pixels[x] = (pixel_t){
+                .r = row[x * 3], .g = row[x * 3 + 1], .b = row[x * 3 + 2]
+            };
+        }
+    }
+
+    free(row);
+    fclose(file);
+    return 0;
+}
+
+
+// Reads a number from a PPM header, skipping the whitespace and comments
+// before it, and the one whitespace character after it.
+int readPpmNumber(FILE *file, uint32_t *number) {
+    int c = fgetc(file);
+    while (c == '#' || c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        if (c == '#') {
+            while (c != '\n' && c != EOF) c = fgetc(file);
+        }
+        c = fgetc(file);
+    }
+
+    if (c < '0' || c > '9') return -1;
+    *number = 0;
+    while (c >= '0' && c <= '9') {
+        // Way past anything that makes sense, and about to wrap around.
+        if (*number > 99999999) return -1;
+        *number = *number * 10 + (c - '0');
+        c = fgetc(file);
+    }
+
+    return c == EOF ? -1 : 0;
+}
@@ -0,0 +1,16 @@
+#ifndef PPM_H
+#define PPM_H
+
+#include <stdint.h>
+
+#include "looker.h"
+
+
+// Writes the image as a binary PPM.
+void imageToFile(const char *fileName, image_t image);
+// Reads a binary PPM (like imageToFile writes) into image,
+// which has to be freed with freeImage. Returns -1 if it can't.
+int imageFromFile(const char *fileName, image_t *image);
+
+
+#endif // PPM_H
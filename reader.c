@@ -3,157 +3,283 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
+#include "binary.h"
 #include "reader.h"
 #include "types.h"
 
 
+// Loaded files this small are read instead of mapped.
+// (Mapping costs more than copying a few pages.)
+#define MIN_MAPPED_SIZE 65536
 
-// int readHaha(FILE *file, board_t *board) {
-//     char c;
-//     char *currentToken;
-//     size_t tokenStart = -1;
+// Lines in the old format can't be longer than this.
+// Boards don't get that big anyway (colors need to fit in a byte).
+#define MAX_LINE_LENGTH 256
 
-//     while (1) {
 
-//         while (isgraph(c = getc(file))) {
-//             if (tokenStart == -1) tokenStart = ftell(file);
+typedef struct {
+    uint64_t hash;
+    const char *token;
+    uint32_t length;
+    uint32_t color;
+} tokenEntry_t;
 
-//         }
+// Hash table from tokens to colors.
+typedef struct {
+    tokenEntry_t *entries;
+    uint32_t capacity;
+    uint32_t count;
+} tokenTable_t;
 
-//         while (isprint());
-//     }
-// }
 
+static uint32_t tokenColor(tokenTable_t *table, const char *token, uint32_t length);
+static uint64_t hashToken(const char *token, uint32_t length);
 
-int readQueensFile(FILE *file, board_t *board) {
 
-    const uint32_t size = board->size;
+// Goes over the text once. It doesn't know yet whether the tokens are
+// cells or whole lines of cells (the old format), so it keeps track of
+// both until the old format doesn't fit anymore.
+int parseQueensText(const char *text, size_t length, board_t *board) {
 
-    // There are exactly the same amount of groups as there are queens.
-    // The amount of queens is equal to the amount of rows (and cols).
-    char identifiers[size];
-    memset(identifiers, 0, size);
-    uint32_t identifiers_index = 0;
+    tokenTable_t table = {0};
+    table.capacity = 64;
+    table.entries = calloc(table.capacity, sizeof(tokenEntry_t));
 
-    // Init the cellCounts to 0 because they start at -1.
-    for (uint32_t i = 0; i < size; i++) {
-        board->groups[i].cellCount = 0;
-    }
+    uint32_t *tokenColors = malloc(64 * sizeof(uint32_t));
+    uint32_t tokenCount = 0;
+    uint32_t tokenCapacity = 64;
 
-    // Set all color and group values in the cells,
-    // and set the cellCounts in the groups.
-    for (uint32_t i = 0; i < size; i++) {
-        for (uint32_t j = 0; j < size; j++) {
-            char c = getc(file);
+    // The old format: one token per line, every token as long as
+    // the amount of lines, and every character is a cell.
+    uint8_t oldFormat = 1;
+    uint32_t lineLength = 0;
+    uint32_t tokensOnLine = 0;
+    int16_t charColors[256];
+    memset(charColors, -1, sizeof(charColors));
+    uint32_t charColorCount = 0;
+    uint32_t *cellColors = NULL;
 
-            if (c == '\n') {
-                fprintf(stderr, "Fuck uhhhh there's a newline in the middle of the board what???\n");
-                return -1;
-            }
+    size_t i = 0;
+    while (i < length) {
+        // Skip the whitespace.
+        while (i < length && isspace((unsigned char)text[i])) {
+            if (text[i] == '\n') tokensOnLine = 0;
+            i++;
+        }
+        if (i == length) break;
 
-            uint32_t color;
+        const char *token = text + i;
+        while (i < length && !isspace((unsigned char)text[i])) i++;
+        const uint32_t tokenLength = text + i - token;
 
-            // Check if we've seen this character before.
-            char *identifiers_ptr = strchr(identifiers, c);
-            if (identifiers_ptr != NULL) {
-                color = identifiers_ptr - identifiers;
-            }
-            else {
-                identifiers[identifiers_index] = c;
-                color = identifiers_index;
-                identifiers_index++;
+        if (tokenCount == tokenCapacity) {
+            tokenCapacity *= 2;
+            tokenColors = realloc(tokenColors, tokenCapacity * sizeof(uint32_t));
+        }
+        tokenColors[tokenCount] = tokenColor(&table, token, tokenLength);
+
+        if (oldFormat) {
+            if (tokenCount == 0) {
+                lineLength = tokenLength;
+                // Way too big for a board, whatever this is.
+                if (lineLength > MAX_LINE_LENGTH) oldFormat = 0;
+                else {
+                    cellColors = malloc(
+                        lineLength * lineLength * sizeof(uint32_t)
+                    );
+                }
             }
 
-            cellSet_t *group = &board->groups[color];
+            if (
+                ++tokensOnLine > 1
+                || tokenLength != lineLength
+                || tokenCount >= lineLength
+            ) {
+                oldFormat = 0;
+            }
 
-            // Set the group values of the cell.
-            board->cells[j + i * size].color = color;
-            board->cells[j + i * size].group = group;
-            group->cellCount++;
+            if (oldFormat) {
+                for (uint32_t c = 0; c < tokenLength; c++) {
+                    uint8_t character = token[c];
+                    if (charColors[character] == -1) {
+                        charColors[character] = charColorCount++;
+                    }
+                    cellColors[tokenCount * lineLength + c] =
+                        charColors[character];
+                }
+            }
         }
-        // Get rid of the pesky newline.
-        getc(file);
+
+        tokenCount++;
     }
 
-    // Allocate the cell pointer arrays in the group sets.
-    for (uint32_t g = 0; g < size; g++) {
-        cellSet_t *group = &board->groups[g];
+    free(table.entries);
 
-        group->cells = malloc(group->cellCount * sizeof(cell_t*));
+    uint32_t size = 0;
+    uint32_t colorCount = 0;
+    uint32_t *colors = NULL;
 
-        // cellCount is used in the next for loop as a way to find
-        // the index of the last unpopulated cell pointer.
-        group->cellCount = 0;
+    if (oldFormat && tokenCount == lineLength && lineLength > 1) {
+        size = lineLength;
+        colorCount = charColorCount;
+        colors = cellColors;
+        free(tokenColors);
     }
+    else {
+        free(cellColors);
+
+        while (size * size < tokenCount) size++;
+        if (size * size != tokenCount || size == 0) {
+            fprintf(stderr,
+                "Your file has %u cells, which ain't a square number 😔.\n",
+                tokenCount
+            );
+            free(tokenColors);
+            return -1;
+        }
 
-    // Populate the cell pointer arrays in the group sets.
-    for (uint32_t c = 0; c < size * size; c++) {
-        cell_t *cell = &board->cells[c];
-        cellSet_t *group = &board->groups[cell->color];
+        colorCount = table.count;
+        colors = tokenColors;
+    }
 
-        group->cells[group->cellCount] = cell;
-        group->cellCount++;
+    if (colorCount != size) {
+        fprintf(stderr,
+            "Your board has %u colors, but it should have %u (its size).\n",
+            colorCount, size
+        );
+        free(colors);
+        return -1;
     }
 
+    *board = createBoard(size);
+    colorBoard(*board, colors);
+    free(colors);
+
     return 0;
 }
 
 
-int measureQueensFile(FILE *file, uint32_t *size) {
-
-    int read_char;
-    uint32_t ret_width = 0;
-
-    // Count the amount of characters in the first line.
-    while ((read_char = fgetc(file)) != '\n' && read_char != EOF) {
-        ret_width++;
+int readQueensFile(FILE *file, board_t *board) {
+    size_t length;
+    uint8_t mapped;
+    const char *text = loadFile(file, &length, &mapped);
+    if (text == NULL) {
+        fprintf(stderr, "Couldn't read the file.\n");
+        return -1;
     }
 
-    if(read_char == EOF) {
-        fprintf(stderr, "Your file is only one line????\n");
-        return -1;
+    int ret;
+    if (binaryBoardLength(text, length)) {
+        ret = unpackBoard(text, length, board, NULL);
     }
+    else ret = parseQueensText(text, length, board);
+    unloadFile(text, length, mapped);
 
-    fseek(file, 0, SEEK_SET);
+    return ret;
+}
 
-    uint32_t hori = 0;
-    uint32_t vert = 1;
 
-    // Count the lines
-    while ((read_char = fgetc(file)) != EOF) {
+const char *loadFile(FILE *file, size_t *length, uint8_t *mapped) {
+    struct stat info;
+    *mapped = 0;
 
-        if (read_char == '\n') {
-            // Make sure every line is the same length.
-            if (hori != ret_width) {
-                fprintf(stderr,
-                    "%d is a malformed line :(\n Line is %d long, I expected %d 😔.\n",
-                    vert, hori, ret_width
-                );
-                return -1;
-            }
+    if (fstat(fileno(file), &info) == 0 && S_ISREG(info.st_mode)) {
+        *length = info.st_size;
 
-            if (hori == 0) {
-                break;
+        if (*length >= MIN_MAPPED_SIZE) {
+            void *map = mmap(
+                NULL, *length, PROT_READ, MAP_PRIVATE, fileno(file), 0
+            );
+            if (map != MAP_FAILED) {
+                madvise(map, *length, MADV_SEQUENTIAL);
+                *mapped = 1;
+                return map;
             }
+        }
+    }
 
-            vert++;
-            hori = 0;
+    // Not a regular file (or a small one), so just read all of it.
+    size_t capacity = 4096;
+    size_t used = 0;
+    char *buffer = malloc(capacity);
+    size_t read;
+    while ((read = fread(buffer + used, 1, capacity - used, file)) > 0) {
+        used += read;
+        if (used == capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
         }
-        else {
-            hori++;
+    }
+
+    *length = used;
+    return buffer;
+}
+
+
+void unloadFile(const char *text, size_t length, uint8_t mapped) {
+    if (mapped) munmap((void *)text, length);
+    else free((void *)text);
+}
+
+
+// Returns the color of a token, giving it a new one if it's new.
+uint32_t tokenColor(tokenTable_t *table, const char *token, uint32_t length) {
+
+    // Keep it at most half full.
+    if (table->count * 2 >= table->capacity) {
+        tokenTable_t bigger = {0};
+        bigger.capacity = table->capacity * 2;
+        bigger.entries = calloc(bigger.capacity, sizeof(tokenEntry_t));
+
+        for (uint32_t e = 0; e < table->capacity; e++) {
+            tokenEntry_t *entry = &table->entries[e];
+            if (entry->token == NULL) continue;
+
+            uint32_t slot = entry->hash & (bigger.capacity - 1);
+            while (bigger.entries[slot].token != NULL) {
+                slot = (slot + 1) & (bigger.capacity - 1);
+            }
+            bigger.entries[slot] = *entry;
         }
+        bigger.count = table->count;
+
+        free(table->entries);
+        *table = bigger;
     }
 
-    if (vert != ret_width) {
-        fprintf(stderr,
-            "Your file ain't square!!! That's not a solvable queens game!!\n"
-            "I measured a width of %d and a height of %d 😔.\n",
-            vert, ret_width
-        );
+    const uint64_t hash = hashToken(token, length);
+    uint32_t slot = hash & (table->capacity - 1);
+
+    while (table->entries[slot].token != NULL) {
+        tokenEntry_t *entry = &table->entries[slot];
+        if (
+            entry->hash == hash
+            && entry->length == length
+            && memcmp(entry->token, token, length) == 0
+        ) return entry->color;
+
+        slot = (slot + 1) & (table->capacity - 1);
     }
 
-    *size = ret_width;
+    table->entries[slot] = (tokenEntry_t){
+        .hash = hash,
+        .token = token,
+        .length = length,
+        .color = table->count
+    };
+    return table->count++;
+}
 
-    return 0;
-}
\ No newline at end of file
+
+// FNV-1a
+uint64_t hashToken(const char *token, uint32_t length) {
+    uint64_t hash = 14695981039346656037ull;
+    for (uint32_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)token[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
@@ -1,16 +1,26 @@
 #ifndef READER_H
 #define READER_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
 #include "types.h"
 
-#define MAX_TOKEN_SIZE 64
 
+// Parses a board in the --help-file format from a piece of memory,
+// and creates (and colors) it. Also takes the old format with one
+// character per cell and no whitespace between them.
+// The board has to be freed with freeBoard.
+int parseQueensText(const char *text, size_t length, board_t *board);
 
-int measureQueensFile(FILE *file, uint32_t *size);
+// Same thing, for a whole file. Also takes binary boards (see binary.h).
 int readQueensFile(FILE *file, board_t *board);
 
+// Gets the whole contents of a file, memory mapped if possible
+// (mapped tells whether it was). Has to be given back with unloadFile.
+const char *loadFile(FILE *file, size_t *length, uint8_t *mapped);
+void unloadFile(const char *text, size_t length, uint8_t mapped);
 
-#endif // READER_H
\ No newline at end of file
+
+#endif // READER_H
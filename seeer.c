@@ -1,10 +1,14 @@
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "seeer.h"
 #include "looker.h"
+#include "ppm.h"
+#include "types.h"
 #include "debug_prints.h"
 
 #define MIN(i, j) (((i) < (j)) ? (i) : (j))
@@ -25,40 +29,207 @@ typedef struct {
     uint32_t count;
 } bin_t;
 
+// How many rows findLines does on a thread at a time.
+#define LINE_STRIP 64
 
-static inline pixel_t* getPix(image_t img, uint32_t x, uint32_t y);
-static uint8_t isCrossing(image_t img, pixel_t *pix, int pixelOffset);
+// The most threads detection uses.
+#define MAX_DETECT_THREADS 64
+
+
+// How many different colors findColors keeps track of on a board.
+#define PALETTE_SIZE 256
+// Colors go in buckets of 16 on every channel.
+#define PALETTE_BITS 4
+#define PALETTE_BUCKETS (1 << (3 * PALETTE_BITS))
+// A color in the palette is just the first cell it was seen on,
+// so it can be COLOR_TOLERANCE off too, both ways.
+#define PALETTE_TOLERANCE (2 * COLOR_TOLERANCE)
+
+// Every color findColors has seen on the board it's looking at.
+// A region is mostly one color, so after its first cell,
+// finding the color of a cell is mostly one lookup in table.
+// Every board starts with an empty one, so colors that drifted
+// on an earlier capture can't steal cells from this one.
+typedef struct {
+    pixel_t colors[PALETTE_SIZE];
+    uint32_t count;
+    // For every bucket, the last color (+ 1) that's
+    // within PALETTE_TOLERANCE of some color in it.
+    uint16_t table[PALETTE_BUCKETS];
+} palette_t;
+
+
+// 4 pixels, or 4 of anything else 32 bits, for the SIMD parts.
+typedef uint32_t v4u32 __attribute__((vector_size(16)));
+
+// A range of rows or columns, end not included.
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+} band_t;
+
+// A band of rows with a line of the grid in it,
+// and the points getPoints found in it.
+typedef struct {
+    image_t img;
+    int pixelOffset;
+    band_t row;
+    band_t *columns;
+    uint32_t columnCount;
+
+    coord_t *points;
+    uint32_t pointCount;
+} scanJob_t;
+
+// What findLines' threads work on.
+typedef struct {
+    image_t img;
+    // For every row or column.
+    uint8_t *isLine;
+    uint32_t minRun;
+
+    // For every strip and column: the length of the run at the top and
+    // bottom of the strip, and whether the whole strip is black.
+    uint32_t *top;
+    uint32_t *bottom;
+    uint8_t *full;
+} lineStrips_t;
+
+
+static inline const pixel_t *getPix(image_t img, uint32_t x, uint32_t y);
+static uint8_t isCrossing(image_t img, const pixel_t *pix, int pixelOffset);
 static uint32_t getPoints(image_t img, coord_t **points, int pixelOffset);
+static uint32_t findLines(image_t img, band_t *bands, uint8_t vertical);
+static void findRowsInStrip(void *context, uint32_t index);
+static void findColumnsInStrip(void *context, uint32_t index);
+static void scanJob(void *context, uint32_t index);
+static void runTasks(
+    void (*task)(void *context, uint32_t index), void *context, uint32_t count
+);
+static void doTasks(void);
+static void *poolWorker(void *arg);
+static uint32_t getCrossingBins(
+    image_t img, bin_t **xBinsOut, bin_t **yBinsOut, uint32_t crossingOffset
+);
+static uint32_t getProjectionBins(
+    image_t img, bin_t **xBinsOut, bin_t **yBinsOut
+);
+static void getProfiles(image_t img, uint32_t *rowRuns, uint32_t *columnRuns);
+static uint32_t getProfileLines(uint32_t *runs, uint32_t length, int32_t *lines);
+static uint32_t fitGrid(
+    int32_t *lines, uint32_t count, int32_t *first, uint32_t *pitch
+);
+static void scanForPoints(
+    image_t img, rect_t area, int pixelOffset,
+    coord_t **coords, uint32_t *coords_n, uint32_t *coords_i
+);
 static inline uint16_t sum(pixel_t pixel);
 static inline uint8_t isBlack(pixel_t pixel);
+static inline uint8_t closePixel(pixel_t a, pixel_t b);
+static uint32_t findPaletteColor(palette_t *palette, pixel_t pixel);
+static inline uint32_t paletteBucket(uint32_t r, uint32_t g, uint32_t b);
 
-static uint32_t *findColors(image_t img, bin_t *xBins, bin_t *yBins, uint32_t size);
+static uint32_t *findColors(
+    image_t img, bin_t *xBins, bin_t *yBins, uint32_t size, uint8_t *marks
+);
+static uint8_t findMark(image_t img, coord_t center, uint32_t cellDistance);
 static coord_t getBins(
     coord_t *points, uint32_t pointCount, bin_t *xBins, bin_t *yBins
 );
 static void sanitizeBins(
     bin_t *xBins, uint32_t *xBins_i, bin_t *yBins, uint32_t *yBins_i
 );
+static uint32_t clusterValues(int32_t *values, uint32_t count, bin_t *bins);
+static uint32_t removeSmallBins(bin_t *bins, uint32_t count);
+static uint32_t getPitch(
+    bin_t *xBins, uint32_t xBins_n, bin_t *yBins, uint32_t yBins_n
+);
+static uint32_t keepGridBins(bin_t *bins, uint32_t count, uint32_t pitch);
+static uint8_t isGridThere(image_t img, boardScreenInfo_t screenInfo);
+static uint8_t isBlackNear(image_t img, int32_t x, int32_t y);
 
 
 #undef DEBUG_PRINT_MODE
 #define DEBUG_PRINT_MODE PRINT_SEEING
 
 
-int compare_bins(const void *a_ptr, const void *b_ptr) {
-    const bin_t a = *((bin_t *) a_ptr);
-    const bin_t b = *((bin_t *) b_ptr);
+int compareInts(const void *a_ptr, const void *b_ptr) {
+    const int32_t a = *((int32_t *) a_ptr);
+    const int32_t b = *((int32_t *) b_ptr);
+    return (a > b) - (a < b);
+}
+
+
+// Sorts by y, and then by x.
+int compareCoords(const void *a_ptr, const void *b_ptr) {
+    const coord_t a = *((coord_t *) a_ptr);
+    const coord_t b = *((coord_t *) b_ptr);
 
-    if (a.coordinate < b.coordinate) return -1;
-    if (a.coordinate > b.coordinate) return 1;
+    if (a.y != b.y) return a.y < b.y ? -1 : 1;
+    if (a.x != b.x) return a.x < b.x ? -1 : 1;
     return 0;
 }
 
 
 uint32_t detectBoard(
-    image_t img, uint32_t **board, boardScreenInfo_t *screenInfo, uint32_t crossingOffset
+    image_t img, uint32_t **board, uint8_t **marks,
+    boardScreenInfo_t *screenInfo, detectOptions_t *options
 ) {
 
+    screenInfo->size = 0;
+
+    // The lines between the cells of the board.
+    bin_t *xBins;
+    bin_t *yBins;
+    uint32_t lineCount;
+    if (options->detector == DETECTOR_PROJECTION) {
+        lineCount = getProjectionBins(img, &xBins, &yBins);
+    }
+    else {
+        lineCount = getCrossingBins(
+            img, &xBins, &yBins, options->crossingOffset
+        );
+    }
+
+    if (lineCount == 0) {
+        printf("No board detected, or the board is too small.\n");
+        return 0;
+    }
+
+    // We are looking for cells, which is the amount of lines + 1.
+    uint32_t size = lineCount + 1;
+    if (size < 5) {
+        printf("The grid is too small.\n");
+        free(xBins);
+        free(yBins);
+        return 0;
+    }
+
+    screenInfo->offset = xBins[1].coordinate - xBins[0].coordinate;
+    screenInfo->y = yBins[0].coordinate - screenInfo->offset / 2;
+    screenInfo->x = xBins[0].coordinate - screenInfo->offset / 2;
+    screenInfo->size = size;
+
+    *marks = malloc(size * size * sizeof(uint8_t));
+    *board = findColors(img, xBins, yBins, size, *marks);
+
+    free(xBins);
+    free(yBins);
+
+    if (*board == NULL) {
+        free(*marks);
+        return 0;
+    }
+
+    return size;
+}
+
+
+// Finds the lines from where they cross each other.
+// Returns how many there are (the same both ways), or 0 without a board.
+uint32_t getCrossingBins(
+    image_t img, bin_t **xBinsOut, bin_t **yBinsOut, uint32_t crossingOffset
+) {
     DPRINTF("Getting points :)\n");
     coord_t *points;
     uint32_t pointCount = getPoints(img, &points, crossingOffset);
@@ -66,7 +237,6 @@ uint32_t detectBoard(
     // We need at least a 5x5 board  (4x4 Queens is impossible).
     if (pointCount < 16) {
         free(points);
-        printf("No board detected, or the board is too small.\n");
         return 0;
     }
 
@@ -80,6 +250,7 @@ uint32_t detectBoard(
     coord_t binCounts = getBins(points, pointCount, xBins, yBins);
     uint32_t xBins_n = binCounts.x;
     uint32_t yBins_n = binCounts.y;
+    free(points);
 
     printf("xBins: ");
     for (uint32_t i = 0; i < xBins_n; i++) {
@@ -93,87 +264,586 @@ uint32_t detectBoard(
     }
     printf("\n");
 
-    // xBins_n is the amount of crossings. We are looking for cells,
-    // which is the amount of crossings + 1.
-    uint32_t size = xBins_n + 1;
-
-    *board = findColors(img, xBins, yBins, size);
-
-    if (*board == NULL) {
-        free(points);
+    if (xBins_n == 0) {
         free(xBins);
         free(yBins);
         return 0;
     }
 
-    screenInfo->offset = xBins[1].coordinate - xBins[0].coordinate;
-    screenInfo->y = yBins[0].coordinate - screenInfo->offset / 2;
-    screenInfo->x = xBins[0].coordinate - screenInfo->offset / 2;
+    *xBinsOut = xBins;
+    *yBinsOut = yBins;
+    return xBins_n;
+}
 
-    free(points);
-    free(xBins);
-    free(yBins);
 
-    return size;
+// Finds the lines from the longest black run in every row and column,
+// which are all found in one pass over the image. The lines of the grid are
+// the evenly spaced ones, including the border around the board.
+// Returns how many lines there are inside the board, or 0 without a board.
+uint32_t getProjectionBins(image_t img, bin_t **xBinsOut, bin_t **yBinsOut) {
+    if (
+        img.width <= 2 * WINDOW_BORDER_MARGIN
+        || img.height <= 2 * WINDOW_BORDER_MARGIN
+    ) return 0;
+
+    uint32_t *rowRuns = calloc(img.height, sizeof(uint32_t));
+    uint32_t *columnRuns = calloc(img.width, sizeof(uint32_t));
+    getProfiles(img, rowRuns, columnRuns);
+
+    int32_t *rows = malloc((img.height / 2 + 1) * sizeof(int32_t));
+    int32_t *columns = malloc((img.width / 2 + 1) * sizeof(int32_t));
+    const uint32_t rowCount = getProfileLines(rowRuns, img.height, rows);
+    const uint32_t columnCount = getProfileLines(columnRuns, img.width, columns);
+    free(rowRuns);
+    free(columnRuns);
+    DPRINTF("%u rows and %u columns with lines\n", rowCount, columnCount);
+
+    int32_t top, left;
+    uint32_t rowPitch, columnPitch;
+    const uint32_t rowLines = fitGrid(rows, rowCount, &top, &rowPitch);
+    const uint32_t columnLines = fitGrid(columns, columnCount, &left, &columnPitch);
+    free(rows);
+    free(columns);
+    DPRINTF("Grid of %u x %u lines, %u x %u apart\n",
+        columnLines, rowLines, columnPitch, rowPitch
+    );
+
+    // Two of the lines are the border.
+    if (
+        rowLines != columnLines || rowLines < 3
+        || abs((int32_t)rowPitch - (int32_t)columnPitch) > MAX_OFFSET_ERROR
+    ) return 0;
+    const uint32_t lineCount = rowLines - 2;
+
+    bin_t *xBins = malloc(lineCount * sizeof(bin_t));
+    bin_t *yBins = malloc(lineCount * sizeof(bin_t));
+    for (uint32_t i = 0; i < lineCount; i++) {
+        xBins[i] = (bin_t){left + (i + 1) * columnPitch, rowLines};
+        yBins[i] = (bin_t){top + (i + 1) * rowPitch, columnLines};
+    }
+
+    *xBinsOut = xBins;
+    *yBinsOut = yBins;
+    return lineCount;
 }
 
 
-uint32_t getPoints(image_t img, coord_t **points, int pixelOffset) {
+// The black pixel check for 4 pixels at once, as 4 masks.
+static inline v4u32 blackMask(v4u32 pixels) {
+    const v4u32 threshold = {
+        BLACK_THRESHOLD, BLACK_THRESHOLD, BLACK_THRESHOLD, BLACK_THRESHOLD
+    };
+    return (v4u32)((pixels & 0xff) < threshold)
+        & (v4u32)(((pixels >> 8) & 0xff) < threshold)
+        & (v4u32)(((pixels >> 16) & 0xff) < threshold);
+}
 
-    coord_t *coords = malloc(32 * sizeof(coord_t));
-    uint32_t coords_n = 32;
-    uint32_t coords_i = 0;
 
+// Gets the longest run of black pixels in every row and every column
+// (inside WINDOW_BORDER_MARGIN). The columns are done 4 at a time,
+// without branches, so it's all a single pass over the image.
+void getProfiles(image_t img, uint32_t *rowRuns, uint32_t *columnRuns) {
     const uint32_t margin = WINDOW_BORDER_MARGIN;
+    const uint32_t left = margin;
+    const uint32_t right = img.width - margin;
+    // The part that's done 4 pixels at a time.
+    const uint32_t vectorRight = left + (right - left) / 4 * 4;
+
+    uint32_t *runs = calloc(img.width, sizeof(uint32_t));
 
     for (uint32_t y = margin; y < img.height - margin; y++) {
-        for (uint32_t x = margin; x < img.width - margin; x++) {
+        const pixel_t *row = getPix(img, 0, y);
+        uint32_t run = 0;
+        uint32_t longest = 0;
+
+        uint32_t x = left;
+        for (; x < vectorRight; x += 4) {
+            v4u32 pixels, current, best;
+            memcpy(&pixels, row + x, sizeof(v4u32));
+            memcpy(&current, runs + x, sizeof(v4u32));
+            memcpy(&best, columnRuns + x, sizeof(v4u32));
+
+            const v4u32 black = blackMask(pixels);
+            current = (current + 1) & black;
+            const v4u32 longer = (v4u32)(current > best);
+            best = (best & ~longer) | (current & longer);
+
+            memcpy(runs + x, &current, sizeof(v4u32));
+            memcpy(columnRuns + x, &best, sizeof(v4u32));
+
+            for (uint32_t i = 0; i < 4; i++) {
+                run = (run + 1) & black[i];
+                longest = run > longest ? run : longest;
+            }
+        }
+        for (; x < right; x++) {
+            const uint32_t black = -(uint32_t)isBlack(row[x]);
+            runs[x] = (runs[x] + 1) & black;
+            columnRuns[x] = MAX(columnRuns[x], runs[x]);
+            run = (run + 1) & black;
+            longest = MAX(longest, run);
+        }
+
+        rowRuns[y] = longest;
+    }
 
-            pixel_t *pix = getPix(img, x, y);
+    free(runs);
+}
 
-            // Did we find a discrepancy?
-            if (isCrossing(img, pix, pixelOffset)) {
-                // Expand the vector if it's too small.
-                if (coords_i == coords_n) {
-                    coords_n += 32;
-                    coords = realloc(coords, coords_n * sizeof(coord_t));
-                }
-                coords[coords_i] = (coord_t){x, y};
-                coords_i++;
+
+// Turns the rows (or columns) with long enough black runs into lines,
+// at the middle of the thick ones.
+uint32_t getProfileLines(uint32_t *runs, uint32_t length, int32_t *lines) {
+    uint32_t count = 0;
+    uint32_t start = 0;
+    uint8_t inLine = 0;
+
+    for (uint32_t i = 0; i <= length; i++) {
+        const uint8_t isLine = i < length && runs[i] >= MIN_LINE_LENGTH;
+        if (isLine && !inLine) start = i;
+        if (!isLine && inLine) lines[count++] = (start + i - 1) / 2;
+        inLine = isLine;
+    }
+
+    return count;
+}
+
+
+// Finds the most lines that are the same distance apart.
+// Gives the first one and the distance, and returns how many there are.
+uint32_t fitGrid(
+    int32_t *lines, uint32_t count, int32_t *first, uint32_t *pitch
+) {
+    uint32_t best = 0;
+    *first = 0;
+    *pitch = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        for (uint32_t j = i + 1; j < count; j++) {
+            const int32_t distance = lines[j] - lines[i];
+            if (distance < MIN_CELL_SIZE) continue;
+
+            uint32_t found = 2;
+            int32_t last = lines[j];
+            for (uint32_t k = j + 1; k < count; k++) {
+                const int32_t error = lines[k] - (last + distance);
+                if (error < -MAX_OFFSET_ERROR) continue;
+                if (error > MAX_OFFSET_ERROR) break;
+                last = lines[k];
+                found++;
+            }
+
+            if (found > best) {
+                best = found;
+                *first = lines[i];
+                // The average is more precise than the first one.
+                *pitch = (last - lines[i]) / (found - 1);
             }
-            // We literally use the green pixels, so we can't have actual
-            // green pixels in the image.
-            else if (pix->g == 255) pix->g = 254;
         }
     }
 
-    if (coords_i == 0) {
-        free(coords);
-        *points = NULL;
+    return best;
+}
+
+
+uint32_t trackBoard(
+    image_t img, uint32_t **board, uint8_t **marks,
+    boardScreenInfo_t *screenInfo
+) {
+    if (img.pixels == NULL || !isGridThere(img, *screenInfo)) {
+        DPRINTF("The board moved or went away.\n");
+        screenInfo->size = 0;
         return 0;
     }
 
-    coords = realloc(coords, coords_i * sizeof(coord_t));
-    *points = coords;
+    // The bins detectBoard would have found.
+    const uint32_t size = screenInfo->size;
+    bin_t xBins[size - 1];
+    bin_t yBins[size - 1];
+    for (uint32_t i = 0; i < size - 1; i++) {
+        const uint32_t line = screenInfo->offset / 2 + i * screenInfo->offset;
+        xBins[i] = (bin_t){screenInfo->x + line, 0};
+        yBins[i] = (bin_t){screenInfo->y + line, 0};
+    }
 
-    return coords_i;
+    *marks = malloc(size * size * sizeof(uint8_t));
+    *board = findColors(img, xBins, yBins, size, *marks);
+
+    if (*board == NULL) {
+        free(*marks);
+        return 0;
+    }
+
+    return size;
+}
+
+
+uint32_t captureBoard(
+    session_t *session, boardScreenInfo_t *locked, boardScreenInfo_t *screenInfo,
+    uint32_t **colors, uint8_t **marks, detectOptions_t *detect,
+    uint8_t exportImage
+) {
+    coord_t browser_coords = {0};
+    uint32_t size;
+
+    if (locked->size) {
+        uint32_t margin = locked->offset / 4;
+        if (margin < TRACKING_MARGIN) margin = TRACKING_MARGIN;
+        const uint32_t side = locked->size * locked->offset + 2 * margin;
+        rect_t region = {
+            (int32_t)locked->x - (int32_t)(locked->offset / 2 + margin),
+            (int32_t)locked->y - (int32_t)(locked->offset / 2 + margin),
+            side, side
+        };
+        image_t image = getBrowserRegion(session, &region, &browser_coords);
+
+        *screenInfo = *locked;
+        screenInfo->x -= region.x;
+        screenInfo->y -= region.y;
+        size = trackBoard(image, colors, marks, screenInfo);
+
+        if (exportImage && image.pixels) {
+            imageToFile("img/export.ppm", image);
+        }
+        freeImage(image);
+
+        if (screenInfo->size) {
+            screenInfo->x += region.x + browser_coords.x;
+            screenInfo->y += region.y + browser_coords.y;
+            return size;
+        }
+
+        // It's gone, so look at the whole window again.
+        printf("Lost the board, looking for it again.\n");
+    }
+
+    image_t image = getBrowserWindow(session, &browser_coords);
+    if (image.pixels == NULL) {
+        // The window couldn't be captured, so there's no board either.
+        *screenInfo = (boardScreenInfo_t){0};
+        *locked = *screenInfo;
+        return 0;
+    }
+    size = detectBoard(image, colors, marks, screenInfo, detect);
+
+    if (exportImage) {
+        imageToFile("img/export.ppm", image);
+    }
+    // Everything needed from the image got copied out of it.
+    freeImage(image);
+
+    *locked = *screenInfo;
+    screenInfo->x += browser_coords.x;
+    screenInfo->y += browser_coords.y;
+    return size;
 }
 
 
-// Finds the crossing and also fucks up the green channel of the image.
-uint8_t isCrossing(image_t img, pixel_t *pix, int pixelOffset) {
-    // Check if the pixels above, to the left and to the top left of this pixel
-    // aren't already green.
+// Checks whether the lines between the cells are still black.
+// Thin lines between cells of the same color don't always count as black,
+// so like in sanitizeBins, every line only needs a few black crossings.
+uint8_t isGridThere(image_t img, boardScreenInfo_t screenInfo) {
+    const uint32_t size = screenInfo.size;
+    const uint32_t offset = screenInfo.offset;
+    if (size < 5 || offset == 0) return 0;
+
+    // The whole board has to be in the image, and a bit more at the top left,
+    // where findColors looks at cells with a mark in them.
+    const int32_t left = (int32_t)screenInfo.x - offset / 2 - offset / 8;
+    const int32_t top = (int32_t)screenInfo.y - offset / 2 - offset / 8;
+    const int32_t right = screenInfo.x + size * offset - offset / 2;
+    const int32_t bottom = screenInfo.y + size * offset - offset / 2;
     if (
-           (pix - 1)->g == 255
-        || (pix - img.width)->g == 255
-        || (pix - 1 - img.width)->g == 255
-    ) {
-        if (pix->g == 255) pix->g = 254;
+        left < 0 || top < 0
+        || right > (int32_t)img.width || bottom > (int32_t)img.height
+    ) return 0;
+
+    uint32_t xCounts[size - 1];
+    uint32_t yCounts[size - 1];
+    memset(xCounts, 0, sizeof(xCounts));
+    memset(yCounts, 0, sizeof(yCounts));
+
+    for (uint32_t j = 0; j < size - 1; j++) {
+        for (uint32_t i = 0; i < size - 1; i++) {
+            const int32_t x = screenInfo.x + offset / 2 + i * offset;
+            const int32_t y = screenInfo.y + offset / 2 + j * offset;
+            if (isBlackNear(img, x, y)) {
+                xCounts[i]++;
+                yCounts[j]++;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < size - 1; i++) {
+        if (xCounts[i] < 3 || yCounts[i] < 3) return 0;
+    }
+    return 1;
+}
+
+
+// Whether there's a black pixel within MAX_OFFSET_ERROR of (x, y).
+uint8_t isBlackNear(image_t img, int32_t x, int32_t y) {
+    for (int32_t dy = -MAX_OFFSET_ERROR; dy <= MAX_OFFSET_ERROR; dy++) {
+        for (int32_t dx = -MAX_OFFSET_ERROR; dx <= MAX_OFFSET_ERROR; dx++) {
+            if (isBlack(*getPix(img, x + dx, y + dy))) return 1;
+        }
+    }
+    return 0;
+}
+
+
+// Only looks for crossings where there are lines, see findLines.
+// Rows of the grid that are far enough apart get scanned on different
+// threads, each with its own points, which get put together at the end.
+uint32_t getPoints(image_t img, coord_t **points, int pixelOffset) {
+    *points = NULL;
+
+    band_t *rows = malloc((img.height / 2 + 1) * sizeof(band_t));
+    band_t *columns = malloc((img.width / 2 + 1) * sizeof(band_t));
+    const uint32_t rowCount = findLines(img, rows, 0);
+    const uint32_t columnCount = findLines(img, columns, 1);
+    DPRINTF("%u rows and %u columns with lines\n", rowCount, columnCount);
+
+    // A 5x5 board has at least 4 lines both ways.
+    if (rowCount < 4 || columnCount < 4) {
+        free(rows);
+        free(columns);
         return 0;
     }
 
+    // Nothing gets written to the image, so every band can go on its own.
+    scanJob_t *jobs = calloc(rowCount, sizeof(scanJob_t));
+    const uint32_t jobCount = rowCount;
+    for (uint32_t r = 0; r < rowCount; r++) {
+        jobs[r] = (scanJob_t){
+            .img = img, .pixelOffset = pixelOffset, .row = rows[r],
+            .columns = columns, .columnCount = columnCount,
+        };
+    }
+
+    runTasks(scanJob, jobs, jobCount);
+
+    uint32_t coords_i = 0;
+    for (uint32_t j = 0; j < jobCount; j++) coords_i += jobs[j].pointCount;
+
+    coord_t *coords = NULL;
+    if (coords_i) {
+        coords = malloc(coords_i * sizeof(coord_t));
+        uint32_t p = 0;
+        for (uint32_t j = 0; j < jobCount; j++) {
+            memcpy(coords + p, jobs[j].points,
+                jobs[j].pointCount * sizeof(coord_t)
+            );
+            p += jobs[j].pointCount;
+        }
+    }
+
+    for (uint32_t j = 0; j < jobCount; j++) free(jobs[j].points);
+    free(jobs);
+    free(rows);
+    free(columns);
+
+    if (coords_i == 0) return 0;
+
+    // Same order as scanning the whole image, getBins cares about that.
+    qsort(coords, coords_i, sizeof(coord_t), compareCoords);
+    *points = coords;
+
+    return coords_i;
+}
+
+
+void scanJob(void *context, uint32_t index) {
+    scanJob_t *job = (scanJob_t *)context + index;
+
+    uint32_t capacity = 32;
+    job->points = malloc(capacity * sizeof(coord_t));
+
+    for (uint32_t c = 0; c < job->columnCount; c++) {
+        rect_t area = {
+            job->columns[c].start, job->row.start,
+            job->columns[c].end - job->columns[c].start,
+            job->row.end - job->row.start
+        };
+        scanForPoints(
+            job->img, area, job->pixelOffset,
+            &job->points, &capacity, &job->pointCount
+        );
+    }
+}
+
+
+// Finds the rows (or columns) with a long run of black pixels in them,
+// which the lines of the grid would be, by only looking at every
+// PYRAMID_STEP-th pixel along them. Close ones get put in the same band,
+// along with PYRAMID_STEP pixels around them.
+// The image gets split into strips of rows, for the threads.
+uint32_t findLines(image_t img, band_t *bands, uint8_t vertical) {
+    const uint32_t margin = WINDOW_BORDER_MARGIN;
+    const uint32_t across = vertical ? img.width : img.height;
+    const uint32_t along = vertical ? img.height : img.width;
+    if (across <= 2 * margin || along <= 2 * margin) return 0;
+
+    lineStrips_t strips = {
+        .img = img,
+        .isLine = calloc(across, sizeof(uint8_t)),
+        .minRun = MIN_LINE_LENGTH / PYRAMID_STEP,
+    };
+
+    if (vertical) {
+        // Every strip is LINE_STRIP rows that get looked at.
+        const uint32_t samples = (img.height - 2 * margin - 1) / PYRAMID_STEP + 1;
+        const uint32_t count = (samples + LINE_STRIP - 1) / LINE_STRIP;
+        strips.top = calloc(count * across, sizeof(uint32_t));
+        strips.bottom = calloc(count * across, sizeof(uint32_t));
+        strips.full = calloc(count * across, sizeof(uint8_t));
+
+        runTasks(findColumnsInStrip, &strips, count);
+
+        // Runs can go on from one strip into the next.
+        for (uint32_t x = margin; x < across - margin; x++) {
+            uint32_t run = 0;
+            for (uint32_t s = 0; s < count && !strips.isLine[x]; s++) {
+                const uint32_t i = s * across + x;
+                if (strips.full[i]) run += strips.top[i];
+                else {
+                    if (run + strips.top[i] >= strips.minRun) strips.isLine[x] = 1;
+                    run = strips.bottom[i];
+                }
+                if (run >= strips.minRun) strips.isLine[x] = 1;
+            }
+        }
+
+        free(strips.top);
+        free(strips.bottom);
+        free(strips.full);
+    }
+    else {
+        const uint32_t count = (img.height - 2 * margin + LINE_STRIP - 1) / LINE_STRIP;
+        runTasks(findRowsInStrip, &strips, count);
+    }
+
+    uint32_t count = 0;
+    for (uint32_t i = margin; i < across - margin; i++) {
+        if (!strips.isLine[i]) continue;
+
+        const uint32_t start = MAX(i, margin + PYRAMID_STEP) - PYRAMID_STEP;
+        const uint32_t end = MIN(i + PYRAMID_STEP + 1, across - margin);
+        if (count && start <= bands[count - 1].end) {
+            bands[count - 1].end = end;
+        }
+        else bands[count++] = (band_t){start, end};
+    }
+
+    free(strips.isLine);
+    return count;
+}
+
+
+// LINE_STRIP rows, every one of them looked at on its own.
+void findRowsInStrip(void *context, uint32_t index) {
+    lineStrips_t *strips = context;
+    const image_t img = strips->img;
+    const uint32_t margin = WINDOW_BORDER_MARGIN;
+
+    const uint32_t first = margin + index * LINE_STRIP;
+    const uint32_t last = MIN(first + LINE_STRIP, img.height - margin);
+
+    for (uint32_t y = first; y < last; y++) {
+        const pixel_t *row = getPix(img, 0, y);
+        uint32_t run = 0;
+        for (uint32_t x = margin; x < img.width - margin; x += PYRAMID_STEP) {
+            run = isBlack(row[x]) ? run + 1 : 0;
+            if (run >= strips->minRun) {
+                strips->isLine[y] = 1;
+                break;
+            }
+        }
+    }
+}
+
+
+// LINE_STRIP of every PYRAMID_STEP-th row, with the runs of every column
+// kept track of at the same time, so it's still read a row at a time.
+// Gives how long the black run at the top and at the bottom of the strip
+// is for every column, so findLines can put them together.
+void findColumnsInStrip(void *context, uint32_t index) {
+    lineStrips_t *strips = context;
+    const image_t img = strips->img;
+    const uint32_t margin = WINDOW_BORDER_MARGIN;
+
+    const uint32_t first = margin + index * LINE_STRIP * PYRAMID_STEP;
+    const uint32_t last = MIN(
+        first + LINE_STRIP * PYRAMID_STEP, img.height - margin
+    );
+
+    uint32_t *top = strips->top + index * img.width;
+    uint32_t *runs = strips->bottom + index * img.width;
+    uint8_t *full = strips->full + index * img.width;
+    memset(full + margin, 1, img.width - 2 * margin);
+
+    for (uint32_t y = first; y < last; y += PYRAMID_STEP) {
+        const pixel_t *row = getPix(img, 0, y);
+        for (uint32_t x = margin; x < img.width - margin; x++) {
+            if (isBlack(row[x])) {
+                runs[x]++;
+                if (full[x]) top[x]++;
+                if (runs[x] >= strips->minRun) {
+                    // Other strips might be setting it too.
+                    __atomic_store_n(&strips->isLine[x], 1, __ATOMIC_RELAXED);
+                }
+            }
+            else {
+                runs[x] = 0;
+                full[x] = 0;
+            }
+        }
+    }
+}
+
+
+// Adds the crossings in an area of the image to coords.
+// A crossing is a few pixels wide, and only its top left one counts.
+void scanForPoints(
+    image_t img, rect_t area, int pixelOffset,
+    coord_t **coords, uint32_t *coords_n, uint32_t *coords_i
+) {
+    // Which pixels of this row and the one above it are crossings, with
+    // a spare one in front for x - 1. The image itself never gets touched.
+    uint8_t found[2][area.width + 1];
+    memset(found, 0, sizeof(found));
+    uint8_t *above = found[0];
+    uint8_t *current = found[1];
+
+    for (uint32_t y = area.y; y < area.y + area.height; y++) {
+        for (uint32_t i = 0; i < area.width; i++) {
+            const uint32_t x = area.x + i;
+
+            // Not if the pixel above, to the left or to the top left of
+            // this one already was.
+            current[i + 1] = !above[i] && !above[i + 1] && !current[i]
+                && isCrossing(img, getPix(img, x, y), pixelOffset);
+            if (!current[i + 1]) continue;
+
+            // Expand the vector if it's too small.
+            if (*coords_i == *coords_n) {
+                *coords_n += 32;
+                *coords = realloc(*coords, *coords_n * sizeof(coord_t));
+            }
+            (*coords)[*coords_i] = (coord_t){x, y};
+            (*coords_i)++;
+        }
+
+        uint8_t *swap = above;
+        above = current;
+        current = swap;
+    }
+}
+
 
+// Whether the pixel is in the middle of a + of black pixels,
+// pixelOffset away from it.
+uint8_t isCrossing(image_t img, const pixel_t *pix, int pixelOffset) {
     // 1 is black, 0 is not black.
     uint8_t conv[3][3] = {
         {0, 1, 0},
@@ -185,21 +855,16 @@ uint8_t isCrossing(image_t img, pixel_t *pix, int pixelOffset) {
     for (int cy = -1; cy <= 1; cy++) {
         for (int cx = -1; cx <= 1; cx++) {
 
-            int32_t offset = pixelOffset * cx + (pixelOffset * cy * img.width);
-            pixel_t *pixPtr = pix + offset;
-
-            pixel_t testPix = *pixPtr;
+            int32_t offset = pixelOffset * cx + (pixelOffset * cy * img.stride);
+            const pixel_t *pixPtr = pix + offset;
 
-            if (isBlack(testPix) != conv[cy + 1][cx + 1]) {
+            if (isBlack(*pixPtr) != conv[cy + 1][cx + 1]) {
                 return 0;
             }
 
         }
     }
 
-    pix->g = 255;
-    pix->r /= 2;
-    pix->b /= 2;
     return 1;
 }
 
@@ -207,41 +872,15 @@ uint8_t isCrossing(image_t img, pixel_t *pix, int pixelOffset) {
 coord_t getBins(
     coord_t *points, uint32_t pointCount, bin_t *xBins, bin_t *yBins
 ) {
-    uint32_t xBins_i = 0;
-    uint32_t yBins_i = 0;
+    int32_t *values = malloc(pointCount * sizeof(int32_t));
 
-    for (uint32_t p = 0; p < pointCount; p++) {
+    for (uint32_t p = 0; p < pointCount; p++) values[p] = points[p].x;
+    uint32_t xBins_i = clusterValues(values, pointCount, xBins);
 
-        uint8_t newXBin = 1;
-        for (uint32_t bin = 0; bin < xBins_i; bin++) {
-            int32_t dif = abs(xBins[bin].coordinate - (int32_t)points[p].x);
-            if (dif < BIN_MARGIN) {
-                xBins[bin].count++;
-                newXBin = 0;
-                break;
-            }
-        }
-        if (newXBin) {
-            xBins[xBins_i].coordinate = points[p].x;
-            xBins[xBins_i].count = 1;
-            xBins_i++;
-        }
+    for (uint32_t p = 0; p < pointCount; p++) values[p] = points[p].y;
+    uint32_t yBins_i = clusterValues(values, pointCount, yBins);
 
-        uint8_t newYBin = 1;
-        for (uint32_t bin = 0; bin < yBins_i; bin++) {
-            int32_t dif = abs(yBins[bin].coordinate - (int32_t)points[p].y);
-            if (dif < BIN_MARGIN) {
-                yBins[bin].count++;
-                newYBin = 0;
-                break;
-            }
-        }
-        if (newYBin) {
-            yBins[yBins_i].coordinate = points[p].y;
-            yBins[yBins_i].count = 1;
-            yBins_i++;
-        }
-    }
+    free(values);
 
     sanitizeBins(xBins, &xBins_i, yBins, &yBins_i);
 
@@ -249,79 +888,125 @@ coord_t getBins(
 }
 
 
+// Sorts the values and sweeps over them. Values less than BIN_MARGIN past
+// the first one of a bin go in that bin, which ends up at their median.
+// The bins come out sorted.
+uint32_t clusterValues(int32_t *values, uint32_t count, bin_t *bins) {
+    qsort(values, count, sizeof(int32_t), compareInts);
+
+    uint32_t binCount = 0;
+    uint32_t start = 0;
+    for (uint32_t i = 1; i <= count; i++) {
+        if (i < count && values[i] - values[start] < BIN_MARGIN) continue;
+
+        bins[binCount++] = (bin_t){values[(start + i - 1) / 2], i - start};
+        start = i;
+    }
+
+    return binCount;
+}
+
+
 void sanitizeBins(
     bin_t *xBins, uint32_t *xBins_i, bin_t *yBins, uint32_t *yBins_i
 ) {
 
-    DPRINTF("xBins: ");
-    for (uint32_t i = 0; i < *xBins_i; i++) {
-        DPRINTF("[%d: %d] ", xBins[i].coordinate, xBins[i].count);
+    // Invalid bins. Probably some other crossing.
+    *xBins_i = removeSmallBins(xBins, *xBins_i);
+    *yBins_i = removeSmallBins(yBins, *yBins_i);
 
-        // Invalid bin. Probably some other crossing.
-        if (xBins[i].count < 3) {
-            xBins[i] = xBins[*xBins_i - 1];
-            *xBins_i -= 1;
-            i--;
-            continue;
-        }
-    }
-    DPRINTF("\nyBins: ");
-    for (uint32_t i = 0; i < *yBins_i; i++) {
-        DPRINTF("[%d: %d] ", yBins[i].coordinate, yBins[i].count);
+    // The distance between the lines, from both ways at once.
+    const uint32_t pitch = getPitch(xBins, *xBins_i, yBins, *yBins_i);
+    DPRINTF("The lines are about %u apart\n", pitch);
 
-        // Invalid bin. Probably some other crossing.
-        if (yBins[i].count < 3) {
-            yBins[i] = yBins[*yBins_i - 1];
-            *yBins_i -= 1;
-            i--;
-            continue;
-        }
-    }
+    // Only the lines of the grid are the right distance apart.
+    *xBins_i = keepGridBins(xBins, *xBins_i, pitch);
+    *yBins_i = keepGridBins(yBins, *yBins_i, pitch);
 
     // Weird situation alert
+    // Whatever's left over on one side is least likely to be the grid
+    // at the end with the fewest points.
     while (*xBins_i != *yBins_i) {
-        bin_t *badBins;
-        uint32_t *badBins_i;
+        bin_t *badBins = *xBins_i > *yBins_i ? xBins : yBins;
+        uint32_t *badBins_i = *xBins_i > *yBins_i ? xBins_i : yBins_i;
 
-        if (*xBins_i > *yBins_i) {
-            badBins = xBins;
-            badBins_i = &*xBins_i;
-        }
-        else {
-            badBins = yBins;
-            badBins_i = &*yBins_i;
+        if (badBins[0].count < badBins[*badBins_i - 1].count) {
+            memmove(badBins, badBins + 1, (*badBins_i - 1) * sizeof(bin_t));
         }
+        *badBins_i -= 1;
+    }
+}
 
-        uint32_t minBin = badBins[0].count;
-        uint32_t minBin_i = 0;
 
-        for (uint32_t i = 1; i < MAX(*xBins_i, *yBins_i); i++) {
-            if (badBins[i].count < minBin) {
-                minBin = badBins[i].count;
-                minBin_i = i;
-            }
-        }
+// Gets rid of bins with less than 3 points, keeping the order.
+uint32_t removeSmallBins(bin_t *bins, uint32_t count) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        DPRINTF("[%d: %d] ", bins[i].coordinate, bins[i].count);
+        if (bins[i].count >= 3) bins[kept++] = bins[i];
+    }
+    DPRINTF("\n");
+    return kept;
+}
 
-        badBins[minBin_i] = badBins[*badBins_i];
-        *badBins_i -= 1;
+
+// The median distance between neighbouring bins.
+uint32_t getPitch(
+    bin_t *xBins, uint32_t xBins_n, bin_t *yBins, uint32_t yBins_n
+) {
+    if (xBins_n + yBins_n < 3) return 0;
+
+    int32_t *distances = malloc((xBins_n + yBins_n) * sizeof(int32_t));
+    uint32_t count = 0;
+    for (uint32_t i = 1; i < xBins_n; i++) {
+        distances[count++] = xBins[i].coordinate - xBins[i - 1].coordinate;
+    }
+    for (uint32_t i = 1; i < yBins_n; i++) {
+        distances[count++] = yBins[i].coordinate - yBins[i - 1].coordinate;
     }
 
+    qsort(distances, count, sizeof(int32_t), compareInts);
+    const uint32_t pitch = count ? distances[count / 2] : 0;
+    free(distances);
+    return pitch;
+}
+
+
+// Keeps the longest row of bins that are pitch apart (give or take
+// MAX_OFFSET_ERROR), moved to the front.
+uint32_t keepGridBins(bin_t *bins, uint32_t count, uint32_t pitch) {
+    if (count == 0) return 0;
+
+    uint32_t bestStart = 0;
+    uint32_t bestLength = 1;
+    uint32_t start = 0;
+    for (uint32_t i = 1; i <= count; i++) {
+        if (i < count) {
+            const int32_t distance = bins[i].coordinate - bins[i - 1].coordinate;
+            if (abs(distance - (int32_t)pitch) <= MAX_OFFSET_ERROR) continue;
+        }
+
+        if (i - start > bestLength) {
+            bestStart = start;
+            bestLength = i - start;
+        }
+        start = i;
+    }
 
-    printf("\nSorting them...\n");
-    qsort(xBins, *xBins_i, sizeof(bin_t), compare_bins);
-    qsort(yBins, *yBins_i, sizeof(bin_t), compare_bins);
+    memmove(bins, bins + bestStart, bestLength * sizeof(bin_t));
+    return bestLength;
 }
 
 
-static void fillBlob(
-    uint32_t *board, uint32_t size, coord_t pos, uint32_t setVal
-);
+static uint32_t labelRegions(uint32_t *board, uint32_t size);
+static inline uint32_t findRoot(uint32_t *parents, uint32_t cell);
 
-uint32_t *findColors(image_t img, bin_t *xBins, bin_t *yBins, uint32_t size) {
+uint32_t *findColors(
+    image_t img, bin_t *xBins, bin_t *yBins, uint32_t size, uint8_t *marks
+) {
 
     uint32_t cellDistance = xBins[1].coordinate - xBins[0].coordinate;
     uint32_t colors_i = 0;
-    pixel_t colors[size];
 
     coord_t origin = (coord_t){
         xBins[0].coordinate - cellDistance / 2,
@@ -330,23 +1015,41 @@ uint32_t *findColors(image_t img, bin_t *xBins, bin_t *yBins, uint32_t size) {
 
     uint32_t *board = malloc(size * size * sizeof(uint32_t));
 
+    palette_t palette;
+    palette.count = 0;
+    memset(palette.table, 0, sizeof(palette.table));
+    // The group of every color of the palette on this board.
+    uint32_t groups[PALETTE_SIZE];
+    memset(groups, 0xff, sizeof(groups));
+
     for (uint32_t y = 0; y < size; y++) {
         for (uint32_t x = 0; x < size; x++) {
-            pixel_t *pixel = getPix(img,
+            coord_t center = {
                 origin.x + cellDistance * x,
                 origin.y + cellDistance * y
-            );
+            };
+
+            // A queen or cross in the middle of the cell hides its color,
+            // so look near its top left corner instead.
+            // The corner is avoided otherwise, because of the borders.
+            marks[x + y * size] = findMark(img, center, cellDistance);
+            if (marks[x + y * size] != CELL_EMPTY) {
+                center.x -= cellDistance * 3 / 8;
+                center.y -= cellDistance * 3 / 8;
+            }
 
-            // Check if color already found.
-            uint8_t colorFound = 0;
-            for (uint32_t c = 0; c < colors_i; c++) {
-                if (memcmp(colors + c, pixel, sizeof(pixel_t)) == 0) {
-                    colorFound = 1;
-                    board[x + y * size] = c;
-                    break;
-                }
+            const pixel_t *pixel = getPix(img, center.x, center.y);
+
+            const uint32_t color = findPaletteColor(&palette, *pixel);
+            if (color == PALETTE_SIZE) {
+                printf("The palette is full, what is this board.\n");
+                free(board);
+                return NULL;
             }
-            if (colorFound) {
+
+            // Check if color already found.
+            if (groups[color] != UINT32_MAX) {
+                board[x + y * size] = groups[color];
                 continue;
             }
 
@@ -357,8 +1060,7 @@ uint32_t *findColors(image_t img, bin_t *xBins, bin_t *yBins, uint32_t size) {
                 return NULL;
             }
             board[x + y * size] = colors_i;
-            colors[colors_i++] = *pixel;
-            pixel->r = 255;
+            groups[color] = colors_i++;
         }
     }
 
@@ -388,22 +1090,7 @@ uint32_t *findColors(image_t img, bin_t *xBins, bin_t *yBins, uint32_t size) {
     }
 
 
-    colors_i = 0;
-
-    // Iterate over the board and replace all the colors with new ones,
-    // with bit 31 set to 1.
-    for (uint32_t i = 0; i < size * size; i++) {
-        if (board[i] & (1 << 31)) continue;
-
-        coord_t pos = {i % size, i / size};
-        fillBlob(board, size, pos, colors_i | (1 << 31));
-        colors_i++; // Keep track of the amount of blobs we place.
-    }
-
-    // Unflip bit 31 for good measure (and debugability) (and preventing segfaults for some).
-    for (uint32_t i = 0; i < size * size; i++) {
-        board[i] ^= (1 << 31);
-    }
+    colors_i = labelRegions(board, size);
 
     if (colors_i != size) {
         printf(
@@ -415,9 +1102,10 @@ uint32_t *findColors(image_t img, bin_t *xBins, bin_t *yBins, uint32_t size) {
     }
 
     #if DEBUG_PRINT_MODE
-    for (uint32_t i = 0; i < colors_i; i++) {
-        printf("Color %d: #%02x%02x%02x\n", i,
-            colors[i].r, colors[i].g, colors[i].b
+    for (uint32_t i = 0; i < palette.count; i++) {
+        if (groups[i] == UINT32_MAX) continue;
+        printf("Color %d: #%02x%02x%02x\n", groups[i],
+            palette.colors[i].r, palette.colors[i].g, palette.colors[i].b
         );
     }
     #endif
@@ -425,42 +1113,239 @@ uint32_t *findColors(image_t img, bin_t *xBins, bin_t *yBins, uint32_t size) {
     return board;
 }
 
-// Recursively replace all values equal to
-// the value on the starting pos to setVal
-void fillBlob(
-    uint32_t *board, uint32_t size, coord_t pos, uint32_t setVal
+// Gives the index of the color in the palette that's close to pixel,
+// adding it if there isn't one. PALETTE_SIZE if the palette is full.
+uint32_t findPaletteColor(palette_t *palette, pixel_t pixel) {
+    const uint16_t entry = palette->table[
+        paletteBucket(pixel.r, pixel.g, pixel.b)
+    ];
+    if (entry && closePixel(palette->colors[entry - 1], pixel)) return entry - 1;
+
+    // Some other color took the bucket, or it's a new one.
+    for (uint32_t i = 0; i < palette->count; i++) {
+        if (closePixel(palette->colors[i], pixel)) return i;
+    }
+
+    if (palette->count == PALETTE_SIZE) return PALETTE_SIZE;
+    const uint32_t color = palette->count++;
+    palette->colors[color] = pixel;
+
+    // Every bucket with colors that are close enough to this one.
+    // PALETTE_TOLERANCE is a bucket, so that's 27 at most.
+    const uint8_t shift = 8 - PALETTE_BITS;
+    for (int32_t r = MAX(pixel.r - PALETTE_TOLERANCE, 0) >> shift;
+        r <= MIN(pixel.r + PALETTE_TOLERANCE, 255) >> shift; r++
+    ) {
+        for (int32_t g = MAX(pixel.g - PALETTE_TOLERANCE, 0) >> shift;
+            g <= MIN(pixel.g + PALETTE_TOLERANCE, 255) >> shift; g++
+        ) {
+            for (int32_t b = MAX(pixel.b - PALETTE_TOLERANCE, 0) >> shift;
+                b <= MIN(pixel.b + PALETTE_TOLERANCE, 255) >> shift; b++
+            ) {
+                palette->table[
+                    (r << (2 * PALETTE_BITS)) | (g << PALETTE_BITS) | b
+                ] = color + 1;
+            }
+        }
+    }
+
+    return color;
+}
+
+
+static inline uint32_t paletteBucket(uint32_t r, uint32_t g, uint32_t b) {
+    const uint8_t shift = 8 - PALETTE_BITS;
+    return ((r >> shift) << (2 * PALETTE_BITS))
+        | ((g >> shift) << PALETTE_BITS)
+        | (b >> shift);
+}
+
+
+// Checks whether there's already a queen or a cross in the cell,
+// by looking at how much of the middle half of the cell is dark.
+uint8_t findMark(image_t img, coord_t center, uint32_t cellDistance) {
+    const int32_t radius = cellDistance / 4;
+    uint32_t dark = 0;
+    uint32_t total = 0;
+
+    for (int32_t y = center.y - radius; y <= center.y + radius; y++) {
+        for (int32_t x = center.x - radius; x <= center.x + radius; x++) {
+            const pixel_t *pixel = getPix(img, x, y);
+            total++;
+            if (
+                pixel->r < MARK_THRESHOLD
+                && pixel->g < MARK_THRESHOLD
+                && pixel->b < MARK_THRESHOLD
+            ) dark++;
+        }
+    }
+
+    if (dark * 100 >= total * QUEEN_COVERAGE) return CELL_QUEEN;
+    if (dark * 100 >= total * CROSS_COVERAGE) return CELL_CROSSED;
+    return CELL_EMPTY;
+}
+
+
+// Gives every group of touching cells of the same color its own number,
+// in the order they first show up. Returns how many there are.
+// Two passes of union-find, so no recursion, however big the board is.
+uint32_t labelRegions(uint32_t *board, uint32_t size) {
+    const uint32_t cellCount = size * size;
+
+    // The root of every group is its first cell.
+    uint32_t *parents = malloc(cellCount * sizeof(uint32_t));
+    for (uint32_t i = 0; i < cellCount; i++) {
+        parents[i] = i;
+
+        const uint32_t x = i % size;
+        uint32_t neighbours[2];
+        uint8_t neighbourCount = 0;
+        if (x > 0) neighbours[neighbourCount++] = i - 1;
+        if (i >= size) neighbours[neighbourCount++] = i - size;
+
+        for (uint8_t n = 0; n < neighbourCount; n++) {
+            if (board[neighbours[n]] != board[i]) continue;
+
+            const uint32_t a = findRoot(parents, neighbours[n]);
+            const uint32_t b = findRoot(parents, i);
+            parents[MAX(a, b)] = MIN(a, b);
+        }
+    }
+
+    // Roots come before the rest of their group,
+    // so they always have a number by the time the rest gets there.
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < cellCount; i++) {
+        const uint32_t root = findRoot(parents, i);
+        board[i] = root == i ? count++ : board[root];
+    }
+
+    free(parents);
+    return count;
+}
+
+
+static inline uint32_t findRoot(uint32_t *parents, uint32_t cell) {
+    while (parents[cell] != cell) {
+        parents[cell] = parents[parents[cell]];
+        cell = parents[cell];
+    }
+    return cell;
+}
+
+
+// ============ Threads ============
+
+// The threads detection runs on. They get started the first time they're
+// needed, and then wait around for the next image.
+static struct {
+    pthread_mutex_t lock;
+    // For the threads, when there's new work.
+    pthread_cond_t start;
+    // For runTasks, when it's all done.
+    pthread_cond_t done;
+    uint32_t threadCount;
+    uint8_t started;
+
+    // Goes up every time there's new work.
+    uint64_t generation;
+    // How many threads are working on it.
+    uint32_t active;
+
+    void (*task)(void *context, uint32_t index);
+    void *context;
+    uint32_t count;
+    uint32_t next;
+    uint32_t finished;
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .start = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+
+// Runs task for every index from 0 to count, on all of the threads
+// (including this one), and returns when they're all done.
+void runTasks(
+    void (*task)(void *context, uint32_t index), void *context, uint32_t count
 ) {
-    const uint32_t index = pos.x + pos.y * size;
-    const uint32_t replaceVal = board[index];
-    board[index] = setVal;
-
-    for (uint8_t i = 0; i < 4; i++) {
-        coord_t newPos;
-        // Check if it isn't out of bounds.
-        switch (i) {
-        case 0:
-            newPos = (coord_t) {pos.x + 1, pos.y};
-            if (newPos.x >= size) continue;
-            break;
-        case 1:
-            newPos = (coord_t) {pos.x, pos.y + 1};
-            if (newPos.y >= size) continue;
-            break;
-        case 2:
-            newPos = (coord_t) {pos.x - 1, pos.y};
-            if (newPos.x < 0) continue;
-            break;
-        case 3:
-            newPos = (coord_t) {pos.x, pos.y - 1};
-            if (newPos.y < 0) continue;
-            break;
+    pthread_mutex_lock(&pool.lock);
+    if (!pool.started) {
+        pool.started = 1;
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        if (processors > MAX_DETECT_THREADS) processors = MAX_DETECT_THREADS;
+        for (long t = 1; t < processors; t++) {
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, poolWorker, NULL) == 0) {
+                pthread_detach(thread);
+                pool.threadCount++;
+            }
         }
+        DPRINTF("Detecting on %u threads\n", pool.threadCount + 1);
+    }
 
-        // Check if it is the value we are replacing.
-        if (board[newPos.x + newPos.y * size] != replaceVal) continue;
+    if (pool.threadCount == 0 || count <= 1) {
+        pthread_mutex_unlock(&pool.lock);
+        for (uint32_t i = 0; i < count; i++) task(context, i);
+        return;
+    }
 
-        fillBlob(board, size, newPos, setVal);
+    // Threads that were late for the last work have to be out of it first.
+    while (pool.active) pthread_cond_wait(&pool.done, &pool.lock);
+
+    pool.task = task;
+    pool.context = context;
+    pool.count = count;
+    pool.next = 0;
+    pool.finished = 0;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.lock);
+
+    doTasks();
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.finished < pool.count) {
+        pthread_cond_wait(&pool.done, &pool.lock);
     }
+    pthread_mutex_unlock(&pool.lock);
+}
+
+
+void doTasks(void) {
+    while (1) {
+        const uint32_t index = __atomic_fetch_add(&pool.next, 1, __ATOMIC_RELAXED);
+        if (index >= pool.count) return;
+
+        pool.task(pool.context, index);
+
+        pthread_mutex_lock(&pool.lock);
+        if (++pool.finished == pool.count) pthread_cond_broadcast(&pool.done);
+        pthread_mutex_unlock(&pool.lock);
+    }
+}
+
+
+void *poolWorker(void *arg) {
+    (void)arg;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&pool.lock);
+    while (1) {
+        while (pool.generation == seen) {
+            pthread_cond_wait(&pool.start, &pool.lock);
+        }
+        seen = pool.generation;
+        pool.active++;
+        pthread_mutex_unlock(&pool.lock);
+
+        doTasks();
+
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.active == 0) pthread_cond_broadcast(&pool.done);
+    }
+
+    return NULL;
 }
 
 
@@ -471,13 +1356,21 @@ static inline uint8_t isBlack(pixel_t pixel) {
 }
 
 
+// Only the colors, the padding byte can be anything.
+static inline uint8_t closePixel(pixel_t a, pixel_t b) {
+    return abs(a.r - b.r) <= PALETTE_TOLERANCE
+        && abs(a.g - b.g) <= PALETTE_TOLERANCE
+        && abs(a.b - b.b) <= PALETTE_TOLERANCE;
+}
+
+
 static inline uint16_t sum(pixel_t pixel) {
     return pixel.r + pixel.g + pixel.b;
 }
 
 
-static inline pixel_t* getPix(image_t img, uint32_t x, uint32_t y) {
-    return img.pixels + (x + y * img.width);
+static inline const pixel_t *getPix(image_t img, uint32_t x, uint32_t y) {
+    return img.pixels + (x + y * img.stride);
 }
 
 
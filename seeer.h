@@ -8,6 +8,17 @@
 // This should *alwayys* be more than like 16
 #define WINDOW_BORDER_MARGIN 32
 
+// Lines of the grid are first looked for at every PYRAMID_STEP-th pixel,
+// and crossings only around the lines that are found.
+#define PYRAMID_STEP 4
+
+// The minimum length (in pixels) of a line of the grid.
+// Shorter black things can't be part of a board.
+#define MIN_LINE_LENGTH 64
+
+// The minimum size of a cell, in pixels.
+#define MIN_CELL_SIZE 12
+
 // The maximum distance the detected points may deviate
 // from the calculated median, to be counted as a valid point.
 #define MAX_OFFSET_ERROR 5
@@ -16,23 +27,83 @@
 // The threshold below which a pixel is considered black.
 #define BLACK_THRESHOLD 10
 
+// Colors that are this close on every channel are the same color.
+// Cells aren't always exactly one flat color, with page zoom and such.
+#define COLOR_TOLERANCE 8
+
+// The threshold below which a pixel is considered part of a queen or
+// cross someone already put on the board. These are antialiased,
+// so this is a lot more lenient than BLACK_THRESHOLD.
+#define MARK_THRESHOLD 100
+
+// The percentage of a cell's center that needs to be dark for it to count
+// as a queen or a cross. Queens are big blobs, crosses are two thin lines.
+#define QUEEN_COVERAGE 25
+#define CROSS_COVERAGE 3
+
 
 #if WINDOW_BORDER_MARGIN < 16
     #error FUCK!!! Your WINDOW_BORDER_MARGIN is too SMALL!!!
 #endif
 
+// How far around the board trackBoard wants to see,
+// at least (it's a quarter of a cell on big boards).
+#define TRACKING_MARGIN 16
+
 // Gives the coordinates of the origin (top-left cell),
 // and the distance between 2 cells (offset).
 typedef struct {
     uint32_t x;
     uint32_t y;
     uint32_t offset;
+    // The amount of cells on a side. Set as soon as the grid is found,
+    // even if the colors weren't right. 0 means there's no grid.
+    uint32_t size;
 } boardScreenInfo_t;
 
+typedef enum {
+    // Finds the lines of the grid from where they cross.
+    DETECTOR_CROSSINGS = 0,
+    // Finds them from the longest black run in every row and column.
+    DETECTOR_PROJECTION,
+} detector_t;
+
+typedef struct {
+    detector_t detector;
+    // How far from a crossing the crossings detector looks.
+    uint32_t crossingOffset;
+} detectOptions_t;
+
+
 // Returns the size of the board, or 0 when it didn't detect one.
+// marks gets the type (CELL_EMPTY, CELL_CROSSED, or CELL_QUEEN)
+// of every cell as it is on the screen.
+// The image only gets read, so it can be looked at again afterwards
+// (or by something else at the same time).
 uint32_t detectBoard(
-    image_t image, uint32_t **board, boardScreenInfo_t *screenInfo,
-    uint32_t crossingOffset
+    image_t image, uint32_t **board, uint8_t **marks,
+    boardScreenInfo_t *screenInfo, detectOptions_t *options
+);
+
+// Like detectBoard, but only checks whether the grid is still where
+// screenInfo (from an earlier detectBoard, moved to the coordinates of this
+// image) says it is, instead of looking for it.
+// The image only needs to be the board and TRACKING_MARGIN around it.
+// If the grid is gone, screenInfo->size becomes 0.
+uint32_t trackBoard(
+    image_t image, uint32_t **board, uint8_t **marks,
+    boardScreenInfo_t *screenInfo
+);
+
+// Captures the window and looks for the board in it.
+// Once a grid has been found, locked remembers where (in window coordinates),
+// and after that only the board gets captured and checked with trackBoard,
+// until it's gone. screenInfo gets screen coordinates.
+// With exportImage, every capture gets written to img/export.ppm.
+uint32_t captureBoard(
+    session_t *session, boardScreenInfo_t *locked, boardScreenInfo_t *screenInfo,
+    uint32_t **colors, uint8_t **marks, detectOptions_t *detect,
+    uint8_t exportImage
 );
 
 
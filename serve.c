@@ -0,0 +1,731 @@
+// For accept4.
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "binary.h"
+#include "corpus.h"
+#include "serve.h"
+#include "solver.h"
+#include "types.h"
+
+
+// How much gets read from a connection at once.
+#define READ_SIZE 65536
+
+
+typedef struct connection_struct connection_t;
+
+// Every connection has MAX_PIPELINED of these, one for every request
+// that can be in flight, and their buffers get reused for the requests
+// after it. So once a connection got going, requests don't allocate.
+typedef struct job_struct {
+    connection_t *connection;
+    uint64_t sequence;
+
+    char *request;
+    size_t length;
+    size_t requestCapacity;
+
+    char *response;
+    size_t responseLength;
+    size_t responseCapacity;
+    // The response is there, but waits for the ones before it.
+    uint8_t finished;
+
+    struct job_struct *next;
+} job_t;
+
+
+struct connection_struct {
+    int fd;
+    // What epoll is watching for.
+    uint32_t events;
+
+    char *in;
+    size_t inLength;
+    size_t inCapacity;
+
+    char *out;
+    size_t outLength;
+    size_t outSent;
+    size_t outCapacity;
+
+    // Indexed by sequence number (modulo MAX_PIPELINED).
+    job_t *jobs;
+    uint64_t nextRequest;
+    uint64_t nextResponse;
+    // Jobs given to the workers that haven't come back yet.
+    uint32_t inFlight;
+
+    // The client won't send anything anymore.
+    uint8_t readClosed;
+    // Something went wrong. It gets dropped as soon as
+    // no jobs point to it anymore.
+    uint8_t broken;
+
+    connection_t *previous;
+    connection_t *next;
+};
+
+
+typedef struct {
+    uint8_t *key;
+    size_t keyLength;
+    uint8_t *solution;
+} cacheEntry_t;
+
+
+typedef struct {
+    serveOptions_t *options;
+
+    int epoll;
+    int listener;
+    // Written to by workers when they finish a job.
+    int wake;
+
+    connection_t *connections;
+
+    // Everything down to the cache is protected by lock.
+    pthread_mutex_t lock;
+    pthread_cond_t available;
+    job_t *queueHead;
+    job_t *queueTail;
+    job_t *done;
+    uint8_t stopping;
+
+    pthread_mutex_t cacheLock;
+    cacheEntry_t *cache;
+    uint64_t hits;
+
+    uint64_t served;
+} server_t;
+
+
+static volatile sig_atomic_t stopRequested = 0;
+
+
+static void handleStop(int signal);
+static int openListener(const char *path);
+static void acceptClients(server_t *server);
+static void readClient(server_t *server, connection_t *connection);
+static void parseRequests(server_t *server, connection_t *connection);
+static ssize_t requestLength(connection_t *connection);
+static void writeClient(connection_t *connection);
+static void collectResults(server_t *server);
+static void updateConnection(server_t *server, connection_t *connection);
+static void freeConnection(server_t *server, connection_t *connection);
+static void *serveWorker(void *arg);
+static void handleRequest(
+    server_t *server, solveOptions_t *options, job_t *job, FILE *out
+);
+static uint8_t lookupSolution(server_t *server, uint8_t *key, size_t keyLength, uint8_t *solution);
+static void storeSolution(server_t *server, uint8_t *key, size_t keyLength, uint8_t *solution, uint32_t size);
+static uint32_t keyHash(uint8_t *key);
+
+
+int serve(const char *path, serveOptions_t *options) {
+    server_t server = {0};
+    server.options = options;
+    server.cache = calloc(SOLUTION_CACHE_SIZE, sizeof(cacheEntry_t));
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.available, NULL);
+    pthread_mutex_init(&server.cacheLock, NULL);
+
+    server.listener = openListener(path);
+    if (server.listener < 0) {
+        free(server.cache);
+        return -1;
+    }
+
+    server.epoll = epoll_create1(EPOLL_CLOEXEC);
+    server.wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    struct epoll_event event = {.events = EPOLLIN};
+    event.data.ptr = &server.listener;
+    epoll_ctl(server.epoll, EPOLL_CTL_ADD, server.listener, &event);
+    event.data.ptr = &server.wake;
+    epoll_ctl(server.epoll, EPOLL_CTL_ADD, server.wake, &event);
+
+    // No SA_RESTART, so epoll_wait gets interrupted.
+    struct sigaction stop = {.sa_handler = handleStop};
+    sigemptyset(&stop.sa_mask);
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+
+    uint32_t threadCount = options->threads;
+    if (threadCount == 0) {
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = processors > 0 ? processors : 1;
+    }
+    pthread_t *threads = malloc(threadCount * sizeof(pthread_t));
+    for (uint32_t t = 0; t < threadCount; t++) {
+        pthread_create(&threads[t], NULL, serveWorker, &server);
+    }
+
+    fprintf(stderr, "Serving on %s with %u threads.\n", path, threadCount);
+
+    struct epoll_event events[64];
+    while (!stopRequested) {
+        int count = epoll_wait(server.epoll, events, 64, -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        // Finished jobs get collected after the connections had their
+        // turn, since collecting them can free connections.
+        uint8_t woken = 0;
+        for (int e = 0; e < count; e++) {
+            void *source = events[e].data.ptr;
+            if (source == &server.listener) {
+                acceptClients(&server);
+                continue;
+            }
+            if (source == &server.wake) {
+                woken = 1;
+                continue;
+            }
+
+            connection_t *connection = source;
+            if (events[e].events & EPOLLIN) readClient(&server, connection);
+            if (events[e].events & EPOLLOUT) writeClient(connection);
+            // The other side is completely gone,
+            // so nobody is going to read the responses.
+            if (events[e].events & (EPOLLHUP | EPOLLERR)) {
+                connection->broken = 1;
+            }
+            updateConnection(&server, connection);
+        }
+
+        if (woken) collectResults(&server);
+    }
+
+    // Let the workers finish what they're doing.
+    pthread_mutex_lock(&server.lock);
+    server.stopping = 1;
+    pthread_cond_broadcast(&server.available);
+    pthread_mutex_unlock(&server.lock);
+    for (uint32_t t = 0; t < threadCount; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+
+    fprintf(stderr,
+        "Solved %" PRIu64 " boards (%" PRIu64 " from the cache).\n",
+        server.served, server.hits
+    );
+
+    // Nothing's running anymore, so everything can just go.
+    // The jobs that are left belong to their connections.
+    while (server.connections) {
+        server.connections->inFlight = 0;
+        server.connections->broken = 1;
+        updateConnection(&server, server.connections);
+    }
+    for (uint32_t c = 0; c < SOLUTION_CACHE_SIZE; c++) {
+        free(server.cache[c].key);
+        free(server.cache[c].solution);
+    }
+    free(server.cache);
+
+    close(server.listener);
+    close(server.wake);
+    close(server.epoll);
+    unlink(path);
+
+    pthread_mutex_destroy(&server.lock);
+    pthread_cond_destroy(&server.available);
+    pthread_mutex_destroy(&server.cacheLock);
+
+    return 0;
+}
+
+
+void handleStop(int signal) {
+    (void)signal;
+    stopRequested = 1;
+}
+
+
+int openListener(const char *path) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long.\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    // Left behind by an earlier server.
+    struct stat info;
+    if (stat(path, &info) == 0 && S_ISSOCK(info.st_mode)) unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (
+        fd < 0
+        || bind(fd, (struct sockaddr *)&address, sizeof(address))
+        || listen(fd, SOMAXCONN)
+    ) {
+        fprintf(stderr, "Couldn't listen on %s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+void acceptClients(server_t *server) {
+    while (1) {
+        int fd = accept4(
+            server->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC
+        );
+        if (fd < 0) return;
+
+        connection_t *connection = calloc(1, sizeof(connection_t));
+        connection->fd = fd;
+        connection->jobs = calloc(MAX_PIPELINED, sizeof(job_t));
+        connection->events = EPOLLIN;
+
+        connection->next = server->connections;
+        if (server->connections) server->connections->previous = connection;
+        server->connections = connection;
+
+        struct epoll_event event = {.events = EPOLLIN};
+        event.data.ptr = connection;
+        epoll_ctl(server->epoll, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+
+// Reads whatever is there (epoll comes back for the rest).
+void readClient(server_t *server, connection_t *connection) {
+    if (connection->inCapacity - connection->inLength < READ_SIZE) {
+        connection->inCapacity = connection->inLength + READ_SIZE;
+        connection->in = realloc(connection->in, connection->inCapacity);
+    }
+
+    ssize_t got = read(
+        connection->fd, connection->in + connection->inLength, READ_SIZE
+    );
+    if (got == 0) connection->readClosed = 1;
+    else if (got < 0) {
+        if (errno != EAGAIN && errno != EINTR) connection->broken = 1;
+        return;
+    }
+    else connection->inLength += got;
+
+    parseRequests(server, connection);
+}
+
+
+// Hands every complete request to the workers.
+void parseRequests(server_t *server, connection_t *connection) {
+    while (connection->nextRequest - connection->nextResponse < MAX_PIPELINED) {
+
+        // Whitespace between requests doesn't count for anything.
+        size_t skip = 0;
+        while (
+            skip < connection->inLength
+            && isspace((unsigned char)connection->in[skip])
+        ) skip++;
+        if (skip) {
+            connection->inLength -= skip;
+            memmove(connection->in, connection->in + skip, connection->inLength);
+        }
+
+        ssize_t length = requestLength(connection);
+        if (length < 0) {
+            fprintf(stderr, "Got a broken binary board, dropping the client.\n");
+            connection->broken = 1;
+            return;
+        }
+        if (length == 0) break;
+
+        job_t *job = &connection->jobs[connection->nextRequest % MAX_PIPELINED];
+        job->connection = connection;
+        job->sequence = connection->nextRequest++;
+        job->next = NULL;
+        if ((size_t)length > job->requestCapacity) {
+            job->requestCapacity = length;
+            job->request = realloc(job->request, length);
+        }
+        job->length = length;
+        memcpy(job->request, connection->in, length);
+
+        connection->inLength -= length;
+        memmove(connection->in, connection->in + length, connection->inLength);
+        connection->inFlight++;
+
+        pthread_mutex_lock(&server->lock);
+        if (server->queueTail) server->queueTail->next = job;
+        else server->queueHead = job;
+        server->queueTail = job;
+        pthread_cond_signal(&server->available);
+        pthread_mutex_unlock(&server->lock);
+    }
+
+    if (connection->inLength > MAX_REQUEST_SIZE) {
+        fprintf(stderr, "Got a request that's way too big, dropping the client.\n");
+        connection->broken = 1;
+    }
+}
+
+
+// Returns the length of the first request in the buffer,
+// 0 if it isn't complete yet, or -1 if it never will be.
+ssize_t requestLength(connection_t *connection) {
+    const char *in = connection->in;
+    const size_t length = connection->inLength;
+    if (length == 0) return 0;
+
+    if (isBinaryBoard(in, length)) {
+        // It can still be a text board that starts with "QB",
+        // which only the whole header tells.
+        if (length < BINARY_HEADER_SIZE && !connection->readClosed) return 0;
+        size_t needed = binaryBoardLength(in, length);
+        if (needed > length) return connection->readClosed ? -1 : 0;
+        if (needed) return needed;
+    }
+
+    // A text board goes on until a blank line.
+    size_t i = 0;
+    while (1) {
+        const char *newline = memchr(in + i, '\n', length - i);
+        if (newline == NULL) break;
+
+        const size_t end = newline - in;
+        size_t c = i;
+        while (c < end && isspace((unsigned char)in[c])) c++;
+        if (c == end) return end + 1;
+
+        i = end + 1;
+    }
+
+    // Whatever is left when the client is done is the last one.
+    return connection->readClosed ? (ssize_t)length : 0;
+}
+
+
+void writeClient(connection_t *connection) {
+    while (connection->outSent < connection->outLength) {
+        ssize_t sent = send(connection->fd,
+            connection->out + connection->outSent,
+            connection->outLength - connection->outSent,
+            MSG_NOSIGNAL | MSG_DONTWAIT
+        );
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EINTR) connection->broken = 1;
+            break;
+        }
+        connection->outSent += sent;
+    }
+
+    if (connection->outSent == connection->outLength) {
+        connection->outSent = 0;
+        connection->outLength = 0;
+    }
+}
+
+
+// Puts the responses of finished jobs in line, and sends
+// whatever can be sent.
+void collectResults(server_t *server) {
+    uint64_t count;
+    if (read(server->wake, &count, sizeof(count)) < 0) {
+        // Nothing new, somebody else got to it.
+    }
+
+    pthread_mutex_lock(&server->lock);
+    job_t *job = server->done;
+    server->done = NULL;
+    pthread_mutex_unlock(&server->lock);
+
+    while (job) {
+        job_t *next = job->next;
+        connection_t *connection = job->connection;
+        connection->inFlight--;
+        server->served++;
+
+        if (!connection->broken) {
+            job->finished = 1;
+
+            // Everything that's next in line goes into the output buffer.
+            job_t *jobs = connection->jobs;
+            while (1) {
+                job_t *ready = &jobs[connection->nextResponse % MAX_PIPELINED];
+                if (!ready->finished) break;
+
+                const size_t length = ready->responseLength;
+                if (connection->outLength + length > connection->outCapacity) {
+                    connection->outCapacity = (connection->outLength + length) * 2;
+                    connection->out = realloc(
+                        connection->out, connection->outCapacity
+                    );
+                }
+                memcpy(
+                    connection->out + connection->outLength,
+                    ready->response, length
+                );
+                connection->outLength += length;
+
+                ready->finished = 0;
+                connection->nextResponse++;
+            }
+
+            writeClient(connection);
+            // There might be room for more requests now.
+            parseRequests(server, connection);
+        }
+
+        updateConnection(server, connection);
+        job = next;
+    }
+}
+
+
+// Closes the connection when it's done, and otherwise makes
+// sure epoll watches for the right things.
+void updateConnection(server_t *server, connection_t *connection) {
+    if (connection->broken) {
+        if (connection->fd >= 0) {
+            epoll_ctl(server->epoll, EPOLL_CTL_DEL, connection->fd, NULL);
+            close(connection->fd);
+            connection->fd = -1;
+        }
+        if (connection->inFlight == 0) freeConnection(server, connection);
+        return;
+    }
+
+    const uint8_t throttled =
+        connection->nextRequest - connection->nextResponse >= MAX_PIPELINED;
+
+    // Nothing left to read, solve or send.
+    if (
+        connection->readClosed
+        && connection->inLength == 0
+        && connection->nextResponse == connection->nextRequest
+        && connection->outLength == 0
+    ) {
+        connection->broken = 1;
+        updateConnection(server, connection);
+        return;
+    }
+
+    uint32_t events = 0;
+    if (!connection->readClosed && !throttled) events |= EPOLLIN;
+    if (connection->outLength) events |= EPOLLOUT;
+
+    if (events != connection->events) {
+        struct epoll_event event = {.events = events};
+        event.data.ptr = connection;
+        epoll_ctl(server->epoll, EPOLL_CTL_MOD, connection->fd, &event);
+        connection->events = events;
+    }
+}
+
+
+void freeConnection(server_t *server, connection_t *connection) {
+    if (connection->previous) connection->previous->next = connection->next;
+    else server->connections = connection->next;
+    if (connection->next) connection->next->previous = connection->previous;
+
+    for (uint32_t j = 0; j < MAX_PIPELINED; j++) {
+        free(connection->jobs[j].request);
+        free(connection->jobs[j].response);
+    }
+    free(connection->jobs);
+    free(connection->in);
+    free(connection->out);
+    free(connection);
+}
+
+
+void *serveWorker(void *arg) {
+    server_t *server = arg;
+
+    // No checkpoints, since nobody would ever resume them.
+    solveOptions_t options = server->options->solve;
+    options.checkpointPath = NULL;
+
+    // Responses get written here first, and the buffer stays around
+    // for the next one.
+    char *buffer = NULL;
+    size_t bufferLength;
+    FILE *out = open_memstream(&buffer, &bufferLength);
+
+    while (1) {
+        pthread_mutex_lock(&server->lock);
+        while (server->queueHead == NULL && !server->stopping) {
+            pthread_cond_wait(&server->available, &server->lock);
+        }
+        job_t *job = server->queueHead;
+        if (server->stopping) {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+        server->queueHead = job->next;
+        if (server->queueHead == NULL) server->queueTail = NULL;
+        pthread_mutex_unlock(&server->lock);
+
+        rewind(out);
+        handleRequest(server, &options, job, out);
+        fflush(out);
+        if (bufferLength > job->responseCapacity) {
+            job->responseCapacity = bufferLength;
+            job->response = realloc(job->response, bufferLength);
+        }
+        memcpy(job->response, buffer, bufferLength);
+        job->responseLength = bufferLength;
+
+        pthread_mutex_lock(&server->lock);
+        job->next = server->done;
+        server->done = job;
+        pthread_mutex_unlock(&server->lock);
+
+        const uint64_t one = 1;
+        if (write(server->wake, &one, sizeof(one)) < 0) {
+            // The counter is full, so it's awake already.
+        }
+    }
+
+    fclose(out);
+    free(buffer);
+    return NULL;
+}
+
+
+// Solves the board in a request, and writes the line of JSON to send back.
+void handleRequest(
+    server_t *server, solveOptions_t *options, job_t *job, FILE *out
+) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // A request is just a corpus with one board in it.
+    corpus_t corpus = {
+        .text = job->request,
+        .length = job->length,
+        .binary = binaryBoardLength(job->request, job->length) != 0,
+    };
+    puzzleView_t puzzle;
+
+    const char *error = NULL;
+    solveStats_t stats = {0};
+    uint32_t size = 0;
+    board_t board;
+
+    if (!nextPuzzle(&corpus, &puzzle)) error = "empty";
+    else if (readPuzzle(&puzzle, &board, NULL)) error = "invalid";
+    else if (board.size > BINARY_MAX_SIZE) {
+        // It wouldn't fit in a cache key.
+        error = "too big";
+        freeBoard(board);
+    }
+    else size = board.size;
+
+    uint8_t solution[size ? size : 1];
+    if (size) {
+        // The packed board is what the cache knows it by.
+        size_t keyLength;
+        uint8_t *key = packBoard(board, NULL, &keyLength);
+
+        if (lookupSolution(server, key, keyLength, solution)) {
+            freeBoard(board);
+            free(key);
+        }
+        else {
+            board = solveWith(board, options, &stats);
+            if (board.size == 0) {
+                error = "unsolvable";
+                free(key);
+            }
+            else {
+                getSolution(board, solution);
+                freeBoard(board);
+                storeSolution(server, key, keyLength, solution, size);
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double ms = (end.tv_sec - start.tv_sec) * 1e3
+        + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+    fprintf(out, "{\"id\":");
+    if (puzzle.id) {
+        writeJsonString(out, puzzle.id, puzzle.idLength);
+    }
+    else {
+        char number[24];
+        writeJsonString(out, number, sprintf(number, "%" PRIu64, job->sequence));
+    }
+    writeResult(out, error, size, solution, ms, stats);
+}
+
+
+uint8_t lookupSolution(
+    server_t *server, uint8_t *key, size_t keyLength, uint8_t *solution
+) {
+    cacheEntry_t *entry = &server->cache[keyHash(key) & (SOLUTION_CACHE_SIZE - 1)];
+    uint8_t found = 0;
+
+    pthread_mutex_lock(&server->cacheLock);
+    if (
+        entry->key
+        && entry->keyLength == keyLength
+        && memcmp(entry->key, key, keyLength) == 0
+    ) {
+        memcpy(solution, entry->solution, key[4]);
+        server->hits++;
+        found = 1;
+    }
+    pthread_mutex_unlock(&server->cacheLock);
+
+    return found;
+}
+
+
+// Takes the key, and replaces whatever was in its spot.
+void storeSolution(
+    server_t *server, uint8_t *key, size_t keyLength,
+    uint8_t *solution, uint32_t size
+) {
+    cacheEntry_t *entry = &server->cache[keyHash(key) & (SOLUTION_CACHE_SIZE - 1)];
+    uint8_t *copy = malloc(size);
+    memcpy(copy, solution, size);
+
+    pthread_mutex_lock(&server->cacheLock);
+    uint8_t *oldKey = entry->key;
+    uint8_t *oldSolution = entry->solution;
+    entry->key = key;
+    entry->keyLength = keyLength;
+    entry->solution = copy;
+    pthread_mutex_unlock(&server->cacheLock);
+
+    free(oldKey);
+    free(oldSolution);
+}
+
+
+// packBoard already hashed the colors for its checksum.
+uint32_t keyHash(uint8_t *key) {
+    return key[8] | key[9] << 8 | key[10] << 16 | (uint32_t)key[11] << 24;
+}
@@ -0,0 +1,40 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdint.h>
+
+#include "solver.h"
+
+
+// Connections stop being read from while they have this many boards
+// waiting for an answer.
+#define MAX_PIPELINED 1024
+
+// A single request can't be bigger than this.
+#define MAX_REQUEST_SIZE (1 << 20)
+
+// How many solutions the server remembers.
+// Has to be a power of 2.
+#define SOLUTION_CACHE_SIZE 4096
+
+
+typedef struct {
+    // 0 means one for every processor.
+    uint32_t threads;
+    solveOptions_t solve;
+} serveOptions_t;
+
+
+// Listens on a unix socket at path, and solves the boards it gets
+// until it gets SIGINT or SIGTERM.
+//
+// A request is a text board ending with a blank line (it can have
+// "# ID" lines, like in a corpus), or a binary board (see binary.h).
+// Clients can send as many as they want without waiting; every request
+// gets a line of JSON back (like --batch prints), in the same order.
+// Text boards without an ID get the number of the request on their
+// connection as ID.
+int serve(const char *path, serveOptions_t *options);
+
+
+#endif // SERVE_H
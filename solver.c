@@ -3,9 +3,13 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include "checkpoint.h"
 #include "solver.h"
+#include "tuning.h"
 #include "types.h"
+#include "util.h"
 
 #include "debug_prints.h"
 
@@ -15,22 +19,55 @@
 // #define PRINT_STEPS
 // #define PRINT_INTERMEDIATE
 
+// The amount of queens bruteForce tries between checking the clock
+// to see if a checkpoint is due.
+#define CHECKPOINT_CHECK_NODES 4096
 
+// The amount of queens between two tries of the quick methods while
+// bruteforcing with the adaptive strategy, when they didn't pay off before.
+#define ADAPTIVE_PROBE_NODES 1024
 
-static uint8_t checkCellBlocker(board_t board, cell_t *cell);
+
+static uint8_t runSearch(
+    board_t board, search_t *search, solveOptions_t *options,
+    uint64_t elapsedMs
+);
+static search_t createSearch(board_t board);
+static void freeSearch(search_t search);
+static uint64_t nanosSince(struct timespec start);
+static uint32_t propagate(board_t board, scratch_t *scratch);
+static void adaptivePass(board_t board, search_t *search);
+static uint8_t checkCellBlocker(
+    board_t board, scratch_t *scratch, cell_t *cell
+);
 static void setQueen(board_t board, cell_t *cell);
+static void removeQueen(board_t board, cell_t *cell, int32_t *columnCounts);
+static int compareCells(const void *a_ptr, const void *b_ptr);
 static void isolate(cellSet_t *set, cell_t *cell);
 static uint8_t markCell(
-    cell_t *potentialBlocker, cell_t *markCell,
-    cellSet_t **affectedSets, size_t *affectedSet_i
+    board_t board, scratch_t *scratch,
+    cell_t *potentialBlocker, cell_t *markCell
 );
 
 
-//! Delete this
-board_t gBoard;
+board_t solve(board_t board) {
+    return solveWith(board, NULL, NULL);
+}
 
 
-board_t solve(board_t board) {
+board_t solveWith(board_t board, solveOptions_t *options, solveStats_t *stats) {
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Every board we'll see has the same size, so this fits all of them.
+    search_t search = createSearch(board);
+    scratch_t *scratch = &search.scratch;
+
+    const strategy_t strategy = options ? options->strategy : STRATEGY_PROPAGATE;
+    if (strategy == STRATEGY_ADAPTIVE) {
+        search.searchCost = getSearchCost(board.size);
+    }
 
     uint32_t prevTotalCellCount = -1;
     [[maybe_unused]]
@@ -39,7 +76,8 @@ board_t solve(board_t board) {
         DPRINTF("Iteration %d\n", iteration);
         iteration++;
 
-        gBoard = board;
+        struct timespec passStart;
+        clock_gettime(CLOCK_MONOTONIC, &passStart);
 
         // Iterate over all sets of the board.
         for (uint32_t s = 0; s < board.size * 3; s++) {
@@ -60,15 +98,9 @@ board_t solve(board_t board) {
         printf("\n");
 #endif
 
-        for (uint32_t j = 0; j < board.size; j++) {
-            for (uint32_t i = 0; i < board.size; i++) {
-                cell_t *cell = &board.cells[i + j*board.size];
-
-                if (cell->type == CELL_CROSSED) continue;
-                if (checkCellBlocker(board, cell)) {
-                    crossCell(cell);
-                }
-            }
+        if (strategy != STRATEGY_SEARCH) {
+            propagate(board, scratch);
+            search.passes++;
         }
 
 
@@ -77,17 +109,59 @@ board_t solve(board_t board) {
             totalCellCount += board.groups[i].cellCount;
         }
 
+        // Stop using the quick methods when they are more expensive
+        // per crossed cell than bruteforcing usually is.
+        uint8_t notWorthIt = 0;
+        if (strategy == STRATEGY_SEARCH) notWorthIt = 1;
+        if (
+            strategy == STRATEGY_ADAPTIVE
+            && search.searchCost > 0
+            && prevTotalCellCount != -1
+            && totalCellCount < prevTotalCellCount
+        ) {
+            double passCost = (double)nanosSince(passStart)
+                / (prevTotalCellCount - totalCellCount);
+            notWorthIt = passCost > search.searchCost;
+        }
+
         if (
-            totalCellCount == prevTotalCellCount
+            (totalCellCount == prevTotalCellCount || notWorthIt)
             && totalCellCount > board.size
+            && !checkBoard(board)
         ) {
             DPRINTF(
                 "The board is not solvable using quick methods. "
                 "Bruteforcing time!\n"
             );
-            board_t solved = bruteForce(board, &board.groups[0], 0);
+
+            struct timespec searchStart;
+            clock_gettime(CLOCK_MONOTONIC, &searchStart);
+
+            if (strategy == STRATEGY_ADAPTIVE) {
+                search.propagate = search.searchCost > 0;
+            }
+
+            uint8_t solved = runSearch(board, &search, options, 0);
+
+            // Remember how expensive that was for the next board.
+            if (strategy == STRATEGY_ADAPTIVE) {
+                learnSearchCost(board.size,
+                    (double)nanosSince(searchStart) / totalCellCount
+                );
+            }
+
+            if (!solved) {
+                freeBoard(board);
+                board = (board_t){.size = 0};
+            }
+            break;
+        }
+
+        // A set ran out of cells, so there is no solution.
+        if (checkBoard(board)) {
             freeBoard(board);
-            return solved;
+            board = (board_t){.size = 0};
+            break;
         }
 
         prevTotalCellCount = totalCellCount;
@@ -101,9 +175,234 @@ board_t solve(board_t board) {
         if (totalCellCount != board.size) continue;
 
         // Solved!
-        return board;
+        break;
+    }
+
+    if (stats) {
+        stats->nodes = search.nodes;
+        stats->passes = search.passes;
+        stats->elapsedMs = millisSince(start);
+    }
+    freeSearch(search);
+
+    return board;
+}
+
+
+board_t resumeSolve(
+    const char *path, solveOptions_t *options, solveStats_t *stats
+) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    checkpoint_t checkpoint;
+    if (loadCheckpoint(path, &checkpoint)) return (board_t){.size = 0};
+
+    const uint32_t size = checkpoint.size;
+    uint32_t colors[size * size];
+    for (uint32_t c = 0; c < size * size; c++) {
+        colors[c] = checkpoint.colors[c];
+
+        if (colors[c] >= size || checkpoint.types[c] > CELL_QUEEN) {
+            fprintf(stderr, "Checkpoint %s has a weird board.\n", path);
+            freeCheckpoint(checkpoint);
+            return (board_t){.size = 0};
+        }
+    }
+
+    board_t board = createBoard(size);
+    colorBoard(board, colors);
+
+    // This is the board as it was when the search started.
+    if (seedBoard(board, checkpoint.types)) {
+        fprintf(stderr, "Checkpoint %s has a broken board.\n", path);
+        freeCheckpoint(checkpoint);
+        freeBoard(board);
+        return (board_t){.size = 0};
     }
 
+    // Keep checkpointing to the same file, unless told otherwise.
+    solveOptions_t resumeOptions = {
+        .checkpointPath = path,
+        .checkpointInterval = DEFAULT_CHECKPOINT_INTERVAL
+    };
+    if (options && options->checkpointPath) resumeOptions = *options;
+    if (options) {
+        resumeOptions.checkpointInterval = options->checkpointInterval;
+    }
+
+    search_t search = createSearch(board);
+    if (resumeOptions.strategy == STRATEGY_ADAPTIVE) {
+        search.searchCost = getSearchCost(size);
+        search.propagate = search.searchCost > 0;
+    }
+    search.resume = checkpoint.decisions;
+    search.resumeDepth = checkpoint.depth;
+    search.nodes = checkpoint.nodes;
+
+    if (!runSearch(board, &search, &resumeOptions, checkpoint.elapsedMs)) {
+        freeBoard(board);
+        board = (board_t){.size = 0};
+    }
+
+    if (stats) {
+        stats->nodes = search.nodes;
+        stats->passes = search.passes;
+        stats->elapsedMs = checkpoint.elapsedMs + millisSince(start);
+    }
+    freeSearch(search);
+    freeCheckpoint(checkpoint);
+
+    return board;
+}
+
+
+// Runs bruteForce on the board, writing checkpoints if asked to.
+// elapsedMs is the time spent on this board before now (when resuming).
+uint8_t runSearch(
+    board_t board, search_t *search, solveOptions_t *options,
+    uint64_t elapsedMs
+) {
+    if (options && options->checkpointPath) {
+        search->checkpointer = startCheckpointer(
+            options->checkpointPath,
+            options->checkpointInterval
+                ? options->checkpointInterval : DEFAULT_CHECKPOINT_INTERVAL,
+            board, elapsedMs
+        );
+    }
+
+    uint8_t solved = bruteForce(board, search, &board.groups[0], 0);
+
+    if (search->checkpointer) {
+        stopCheckpointer(search->checkpointer);
+        search->checkpointer = NULL;
+    }
+
+    return solved;
+}
+
+
+search_t createSearch(board_t board) {
+    search_t search = {0};
+
+    search.scratch = createScratch(board);
+    search.decisions = calloc(board.size, sizeof(uint32_t));
+    search.nextProbe = UINT64_MAX;
+
+    return search;
+}
+
+
+void freeSearch(search_t search) {
+    freeScratch(search.scratch);
+    free(search.decisions);
+}
+
+
+uint64_t nanosSince(struct timespec start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t)(now.tv_sec - start.tv_sec) * 1000000000
+        + (now.tv_nsec - start.tv_nsec);
+}
+
+
+// Crosses every cell that would block a set if it were a queen.
+// Returns the amount of crossed cells.
+uint32_t propagate(board_t board, scratch_t *scratch) {
+    uint32_t crossed = 0;
+
+    for (uint32_t j = 0; j < board.size; j++) {
+        for (uint32_t i = 0; i < board.size; i++) {
+            cell_t *cell = &board.cells[i + j*board.size];
+
+            if (cell->type == CELL_CROSSED) continue;
+            if (checkCellBlocker(board, scratch, cell)) {
+                crossCell(cell);
+                crossed++;
+            }
+        }
+    }
+
+    return crossed;
+}
+
+
+void getSolution(board_t board, uint8_t *columns) {
+    // Everything but the queen got crossed off, so it's the only cell left.
+    for (uint32_t y = 0; y < board.size; y++) {
+        columns[y] = board.rows[y].cells[0]->x;
+    }
+}
+
+
+// When this fails the board is left half seeded,
+// so the caller should start over with a fresh one.
+int seedBoard(board_t board, uint8_t *marks) {
+    const uint32_t cellCount = board.size * board.size;
+
+    // Queens can't rule each other out.
+    for (uint32_t i = 0; i < cellCount; i++) {
+        if (marks[i] != CELL_QUEEN) continue;
+        for (uint32_t j = i + 1; j < cellCount; j++) {
+            if (
+                marks[j] == CELL_QUEEN
+                && inConflict(board, &board.cells[i], &board.cells[j])
+            ) return -1;
+        }
+    }
+
+    for (uint32_t i = 0; i < cellCount; i++) {
+        if (marks[i] == CELL_CROSSED) crossCell(&board.cells[i]);
+    }
+    for (uint32_t i = 0; i < cellCount; i++) {
+        if (marks[i] == CELL_QUEEN) setQueen(board, &board.cells[i]);
+    }
+
+    return checkBoard(board) ? -1 : 0;
+}
+
+
+board_t createDetectedBoard(
+    uint32_t size, uint32_t *colors, uint8_t *marks,
+    uint8_t ignoreMarks, uint8_t *seeded
+) {
+    board_t board = createBoard(size);
+    colorBoard(board, colors);
+
+    *seeded = 0;
+    if (ignoreMarks) {
+        memset(marks, CELL_EMPTY, size * size);
+    }
+    else if (seedBoard(board, marks)) {
+        printf("The queens on the screen can't be right, ignoring them.\n");
+        freeBoard(board);
+        board = createBoard(size);
+        colorBoard(board, colors);
+    }
+    else *seeded = 1;
+
+    return board;
+}
+
+
+board_t solveDetected(
+    board_t board, uint32_t *colors, uint8_t seeded,
+    solveOptions_t *options, solveStats_t *stats
+) {
+    const uint32_t size = board.size;
+    board = solveWith(board, options, stats);
+
+    // The crosses on the screen might have been wrong.
+    if (board.size == 0 && seeded) {
+        printf("That didn't work, solving it from scratch.\n");
+        board = createBoard(size);
+        colorBoard(board, colors);
+        board = solveWith(board, options, stats);
+    }
+    return board;
 }
 
 
@@ -116,7 +415,7 @@ void setQueen(board_t board, cell_t *cell) {
         cell->sets[i]->solved = 1;
     }
 
-    corners_t corners = getCorners(board, *cell);
+    corners_t corners = getCorners(board, cell);
     for (uint8_t i = 0; i < corners.count; i++) {
         crossCell(corners.cells[i]);
     }
@@ -169,98 +468,49 @@ void isolate(cellSet_t *set, cell_t *cell) {
 // Check if this cell being a queen would completely
 // empty out a set of cells.
 // (Like, it blocks a group completely or something.)
-uint8_t checkCellBlocker(board_t board, cell_t *cell) {
-
-    // Count amount of sets this cell is going to affect.
-    size_t affectedSetCount = 3 * (
-        cell->column->cellCount + cell->row->cellCount + cell->group->cellCount
-        - 3 // We ignore the cell we're checking in the iterations,
-            // so we don't count it.
-    ) + 4; // Add 4 for the four corners.
-
-    // Allocate an array of that amount of pointers.
-    cellSet_t **affectedSets = malloc(affectedSetCount * sizeof(cellSet_t*));
-    size_t affectedSet_i = 0;
-
-    uint8_t isBlocker = 0;
-
-
-    // Iterate over every affected set.
-    for (uint32_t s = 0; s < 3; s++) {
-        for (uint32_t c = 0; c < cell->sets[s]->cellCount; c++) {
-            cell_t *mCell = cell->sets[s]->cells[c];
-            if (mCell == cell) {
-                continue;
-            }
-
-            if (markCell(cell, mCell, affectedSets, &affectedSet_i)) {
-                isBlocker = 1;
-                goto break_all;
-            }
+uint8_t checkCellBlocker(board_t board, scratch_t *scratch, cell_t *cell) {
 
-        }
-    }
+    // Every cell this cell would rule out, according to the conflict table.
+    // The list doesn't contain duplicates, so cells don't need marking.
+    const uint32_t index = cell->x + cell->y * board.size;
+    const uint32_t *conflicts = &board.conflicts->indices[
+        board.conflicts->offsets[index]
+    ];
+    const uint32_t conflictCount =
+        board.conflicts->offsets[index + 1] - board.conflicts->offsets[index];
 
-    // Iterate over corners.
-    corners_t corners = getCorners(board, *cell);
-    for (uint8_t i = 0; i < corners.count; i++) {
-        if (markCell(cell, corners.cells[i], affectedSets, &affectedSet_i)) {
-            isBlocker = 1;
-            break;
-        }
-    }
-
-    // Unmark corner cells
-    for (uint8_t i = 0; i < corners.count; i++)
-        if(corners.cells[i]->type == CELL_MARKED)
-            corners.cells[i]->type = CELL_EMPTY;
+    // Forget the set marks of the previous probe.
+    nextEpoch(scratch);
 
-    break_all:
+    for (uint32_t c = 0; c < conflictCount; c++) {
+        cell_t *mCell = &board.cells[conflicts[c]];
+        if (mCell->type == CELL_CROSSED) continue;
 
-    // Unmark cells
-    for (uint32_t s = 0; s < 3; s++) {
-        for (uint32_t c = 0; c < cell->sets[s]->cellCount; c++) {
-            cell_t *markCell = cell->sets[s]->cells[c];
-            if (markCell->type == CELL_MARKED)
-                markCell->type = CELL_EMPTY;
+        if (markCell(board, scratch, cell, mCell)) {
+            return 1;
         }
     }
 
-    // Set the variable of all the affected sets back to 0.
-    for (size_t i = 0; i < affectedSet_i; i++) {
-        affectedSets[i]->variable = 0;
-    }
-
-    free(affectedSets);
-
-
-    return isBlocker;
+    return 0;
 }
 
 
+// Counts the cell as ruled out in each of its sets the blocker isn't in.
+// Returns 1 if that rules out a whole set.
 uint8_t markCell(
-    cell_t *potentialBlocker, cell_t *markCell,
-    cellSet_t **affectedSets, size_t *affectedSet_i
+    board_t board, scratch_t *scratch,
+    cell_t *potentialBlocker, cell_t *markCell
 ) {
-    // Don't doubly mark cells.
-    if (markCell->type == CELL_MARKED) return 0;
-    markCell->type = CELL_MARKED;
-
     for (uint32_t mark_s = 0; mark_s < 3; mark_s++) {
         cellSet_t *markSet = markCell->sets[mark_s];
         if (inSet(markSet, potentialBlocker)) continue;
 
-        // We use the cool variable field for this
-        // (very useful)
-        if (markSet->variable == 0) {
-            affectedSets[*affectedSet_i] = markSet;
-            (*affectedSet_i)++;
-        }
-        markSet->variable++;
+        int32_t *mark = getSetMark(scratch, board, markSet);
+        (*mark)++;
 
-        if (markSet->cellCount - markSet->variable <= 0) {
+        if (markSet->cellCount - *mark <= 0) {
 #if DEBUG_PRINT_MODE
-            visuPrompt(gBoard, potentialBlocker, markCell, markSet);
+            visuPrompt(board, potentialBlocker, markCell, markSet);
 #endif
             return 1;
         }
@@ -272,59 +522,150 @@ uint8_t markCell(
 
 
 
-board_t bruteForce(board_t board, cellSet_t *group, uint32_t depth) {
-    for (uint32_t c = 0; c < group->cellCount; c++) {
-        board_t copy = copyBoard(board);
+uint8_t bruteForce(
+    board_t board, search_t *search, cellSet_t *group, uint32_t depth
+) {
+    // Placing and removing queens shuffles the group's cells around,
+    // so iterate over a snapshot. Sorting it keeps the search order
+    // independent of the order in which cells were uncrossed.
+    const uint32_t candidateCount = group->cellCount;
+    cell_t *candidates[candidateCount];
+    memcpy(candidates, group->cells, candidateCount * sizeof(cell_t*));
+    qsort(candidates, candidateCount, sizeof(cell_t*), compareCells);
+
+    // Everything a queen crosses ends up behind the column counts,
+    // so these are all we need to undo it.
+    int32_t columnCounts[board.size];
+    for (uint32_t i = 0; i < board.size; i++) {
+        columnCounts[i] = board.columns[i].cellCount;
+    }
+
+    for (uint32_t c = 0; c < candidateCount; c++) {
+        cell_t *cell = candidates[c];
+        const uint32_t index = cell->x + cell->y * board.size;
 
-        // Get cell from original board.
-        cell_t *cell = group->cells[c];
-        // Translate that to a cell from the copied board.
-        cell = &copy.cells[cell->x + copy.size * cell->y];
+        // When resuming, skip the queens the checkpoint was already past.
+        // Once we're past the checkpoint's queen we're on our own.
+        if (depth < search->resumeDepth) {
+            if (index < search->resume[depth]) continue;
+            if (index > search->resume[depth]) search->resumeDepth = depth;
+        }
+
+        search->decisions[depth] = index;
+        search->nodes++;
+        if (
+            search->checkpointer
+            && search->nodes % CHECKPOINT_CHECK_NODES == 0
+        ) {
+            offerCheckpoint(
+                search->checkpointer, search->decisions, depth + 1,
+                search->nodes
+            );
+        }
 
         for (uint8_t t = 0; t < depth; t++) DPRINTF("\t");
         DPRINTF("%2d: Trying queen at [%d, %d]\n",
             group->identifier, cell->x, cell->y
         );
 
-        if (checkCellBlocker(copy, cell)) {
+        // The quick methods might have solved this group already.
+        if (cell->type == CELL_QUEEN) {
+            if (depth + 1 == board.size) return 1;
+            return bruteForce(
+                board, search, &board.groups[group->identifier + 1], depth + 1
+            );
+        }
+
+        if (checkCellBlocker(board, &search->scratch, cell)) {
             for (uint8_t t = 0; t < depth; t++) DPRINTF("\t");
             DPRINTF("It a blocker..\n");
-            freeBoard(copy);
             continue;
         }
 
-        setQueen(copy, cell);
+        setQueen(board, cell);
 
-        if (checkBoard(copy)) {
+        if (
+            !checkBoard(board)
+            && (search->propagate || search->nodes >= search->nextProbe)
+        ) {
+            adaptivePass(board, search);
+        }
+
+        if (checkBoard(board)) {
             for (uint8_t t = 0; t < depth; t++) DPRINTF("\t");
             DPRINTF("Bad idea..\n");
-            freeBoard(copy);
+            removeQueen(board, cell, columnCounts);
             continue;
         }
 
 #if DEBUG_PRINT_MODE
-        printBoard(copy, depth);
+        printBoard(board, depth);
 #endif
 
         // If we passed the check and this is the last group,
         // we have solved the board.
-        if (depth + 1 == board.size) return copy;
+        if (depth + 1 == board.size) return 1;
 
+        // Leave the board as it is if the next recursion layer solved it.
+        if (bruteForce(
+            board, search, &board.groups[group->identifier + 1], depth + 1
+        )) return 1;
 
-        board_t ret = bruteForce(
-            copy, &copy.groups[group->identifier + 1], depth + 1
-        );
+        removeQueen(board, cell, columnCounts);
+
+        // Whatever the checkpoint had below this queen is done now.
+        if (depth < search->resumeDepth) search->resumeDepth = depth;
+    }
+
+    return 0;
+}
 
-        // Return the board if the next recursion layer solved it.
-        if (ret.size) {
-            freeBoard(copy);
-            return ret;
-        }
 
-        freeBoard(copy);
+// Runs the quick methods while bruteforcing, and keeps track of whether
+// that's worth it. Everything it crosses gets uncrossed by removeQueen.
+void adaptivePass(board_t board, search_t *search) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    uint32_t crossed = propagate(board, &search->scratch);
+    search->passes++;
+
+    // A pass that crosses nothing still cost something.
+    double cost = (double)nanosSince(start) / (crossed ? crossed : 1);
+    if (search->passCost == 0) search->passCost = cost;
+    else search->passCost = 0.9 * search->passCost + 0.1 * cost;
+
+    search->propagate = search->passCost < search->searchCost;
+    if (!search->propagate) {
+        search->nextProbe = search->nodes + ADAPTIVE_PROBE_NODES;
     }
+}
+
 
-    return (board_t){.size = 0};
+// Undoes setQueen, given the column counts from before it was placed.
+void removeQueen(board_t board, cell_t *cell, int32_t *columnCounts) {
+    for (uint8_t i = 0; i < 3; i++) {
+        cell->sets[i]->solved = 0;
+    }
+    cell->type = CELL_EMPTY;
+
+    for (uint32_t i = 0; i < board.size; i++) {
+        cellSet_t *column = &board.columns[i];
+        while (column->cellCount < columnCounts[i]) {
+            uncrossCell(column->cells[column->cellCount]);
+        }
+    }
+}
+
+
+// Orders cells by their position on the board.
+int compareCells(const void *a_ptr, const void *b_ptr) {
+    const cell_t *a = *((cell_t **) a_ptr);
+    const cell_t *b = *((cell_t **) b_ptr);
+
+    if (a->y != b->y) return a->y < b->y ? -1 : 1;
+    if (a->x != b->x) return a->x < b->x ? -1 : 1;
+    return 0;
 }
 
 
@@ -1,6 +1,7 @@
 #ifndef SOLVER_H
 #define SOLVER_H
 
+#include "checkpoint.h"
 #include "types.h"
 
 
@@ -9,13 +10,116 @@
 // #define PRINT_INTERMEDIATE
 // #define PRINT_LOGS
 
+// How solveWith divides its time between the quick methods
+// and bruteforcing.
+typedef enum {
+    // Use the quick methods until they stop finding anything.
+    STRATEGY_PROPAGATE = 0,
+    // Start bruteforcing right away.
+    STRATEGY_SEARCH,
+    // Use the quick methods for as long as they are cheaper than
+    // bruteforcing, based on what was learned on earlier boards
+    // (see tuning.h). Also uses them while bruteforcing if they pay off.
+    STRATEGY_ADAPTIVE,
+} strategy_t;
+
+
+typedef struct {
+    strategy_t strategy;
+
+    // While bruteforcing, write a checkpoint to this file every
+    // checkpointInterval seconds (0 means the default).
+    // NULL means no checkpoints.
+    const char *checkpointPath;
+    uint32_t checkpointInterval;
+} solveOptions_t;
+
+
+typedef struct {
+    // The amount of queens bruteForce tried.
+    uint64_t nodes;
+    // The amount of times the quick methods went over the board.
+    uint64_t passes;
+    // Including the time spent before a checkpoint, when resuming.
+    uint64_t elapsedMs;
+} solveStats_t;
+
+
+// State of a bruteForce search.
+typedef struct {
+    scratch_t scratch;
+
+    // The cell index of the queen placed at every depth.
+    uint32_t *decisions;
+
+    // The decisions of the checkpoint being resumed from.
+    // Only the first resumeDepth of them still matter.
+    const uint32_t *resume;
+    uint32_t resumeDepth;
+
+    uint64_t nodes;
+    uint64_t passes;
+
+    // NULL if not writing checkpoints.
+    checkpointer_t *checkpointer;
+
+    // Whether to use the quick methods after placing every queen.
+    // With the adaptive strategy this gets turned off when they cost
+    // more per crossed cell than searchCost, and tried again every
+    // ADAPTIVE_PROBE_NODES queens.
+    uint8_t propagate;
+    double searchCost;
+    double passCost;
+    uint64_t nextProbe;
+} search_t;
+
+
 // Use this function like this:
 // myBoard = solve(myBoard);
 // Pointers in myBoard might change completely.
 // It will free the previous pointers if that is the case.
 // You do still need to free the returned board when you're done with it.
+// If the board can't be solved, it returns a board with size 0
+// (and there is nothing left to free).
 board_t solve(board_t board);
-board_t bruteForce(board_t board, cellSet_t *group, uint32_t depth);
+// Same as solve, with options and statistics (both can be NULL).
+board_t solveWith(board_t board, solveOptions_t *options, solveStats_t *stats);
+// Continues the search saved in a checkpoint written by solveWith.
+// Returns the solved board, or a board of size 0.
+board_t resumeSolve(
+    const char *path, solveOptions_t *options, solveStats_t *stats
+);
+
+// Puts the queens and crosses from marks (one CELL_ type per cell)
+// on a freshly colored board, so solve can take it from there.
+// Returns -1 if they can't be part of a solution.
+int seedBoard(board_t board, uint8_t *marks);
+
+// Creates a board with the colors that were detected on the screen,
+// seeded with the marks that were already on it, unless ignoreMarks
+// is set (then marks gets cleared) or they can't be right.
+// Sets seeded to whether the marks made it onto the board.
+board_t createDetectedBoard(
+    uint32_t size, uint32_t *colors, uint8_t *marks,
+    uint8_t ignoreMarks, uint8_t *seeded
+);
+
+// Solves a board from createDetectedBoard, and if the marks it was
+// seeded with turn out to be wrong, solves it again from scratch.
+// Returns the solved board, or a board of size 0.
+board_t solveDetected(
+    board_t board, uint32_t *colors, uint8_t seeded,
+    solveOptions_t *options, solveStats_t *stats
+);
+
+// Writes the column of the queen on every row of a solved board.
+void getSolution(board_t board, uint8_t *columns);
+
+// Solves the board in place. Returns 1 if it found a solution,
+// and 0 (with the board back in its original state) if it didn't.
+uint8_t bruteForce(
+    board_t board, search_t *search, cellSet_t *group, uint32_t depth
+);
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,285 @@
+// Sends the boards in a corpus to a `queens --serve` socket, as fast as it
+// can and over as many connections as you want, and tells how fast the
+// answers came back. For load testing.
+//
+// Usage: queens-client SOCKET FILE [CONNECTIONS [ROUNDS]]
+// Every connection sends every board in FILE, ROUNDS times.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "corpus.h"
+
+
+typedef struct {
+    // Every request, back to back.
+    char *data;
+    size_t *offsets;
+    uint32_t count;
+    uint32_t rounds;
+    const char *path;
+} requests_t;
+
+
+typedef struct {
+    requests_t *requests;
+    int fd;
+
+    // When every request got sent (in ns), and how long its answer took.
+    uint64_t *sent;
+    double *latencies;
+    uint32_t answered;
+    uint32_t errors;
+    uint8_t failed;
+} connection_t;
+
+
+static int loadRequests(const char *path, requests_t *requests);
+static void *runConnection(void *arg);
+static void *sendRequests(void *arg);
+static uint64_t nanos(void);
+static int compareDoubles(const void *a, const void *b);
+
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s SOCKET FILE [CONNECTIONS [ROUNDS]]\n", argv[0]);
+        return -1;
+    }
+
+    requests_t requests = {.path = argv[1], .rounds = 1};
+    uint32_t connectionCount = 1;
+    if (argc > 3) connectionCount = strtol(argv[3], NULL, 0);
+    if (argc > 4) requests.rounds = strtol(argv[4], NULL, 0);
+    if (connectionCount == 0 || requests.rounds == 0) {
+        fprintf(stderr, "Need at least 1 connection and 1 round.\n");
+        return -1;
+    }
+
+    if (loadRequests(argv[2], &requests)) return -1;
+    const uint32_t perConnection = requests.count * requests.rounds;
+
+    connection_t *connections = calloc(connectionCount, sizeof(connection_t));
+    pthread_t *threads = malloc(connectionCount * sizeof(pthread_t));
+
+    const uint64_t start = nanos();
+    for (uint32_t c = 0; c < connectionCount; c++) {
+        connections[c].requests = &requests;
+        connections[c].sent = calloc(perConnection, sizeof(uint64_t));
+        connections[c].latencies = calloc(perConnection, sizeof(double));
+        pthread_create(&threads[c], NULL, runConnection, &connections[c]);
+    }
+    for (uint32_t c = 0; c < connectionCount; c++) {
+        pthread_join(threads[c], NULL);
+    }
+    const double seconds = (nanos() - start) / 1e9;
+
+    // All the latencies together.
+    double *latencies = malloc(connectionCount * perConnection * sizeof(double));
+    uint32_t answered = 0;
+    uint32_t errors = 0;
+    uint32_t failed = 0;
+    for (uint32_t c = 0; c < connectionCount; c++) {
+        memcpy(latencies + answered, connections[c].latencies,
+            connections[c].answered * sizeof(double)
+        );
+        answered += connections[c].answered;
+        errors += connections[c].errors;
+        failed += connections[c].failed;
+        free(connections[c].sent);
+        free(connections[c].latencies);
+    }
+    qsort(latencies, answered, sizeof(double), compareDoubles);
+
+    printf("%u of %u boards answered (%u errors) over %u connections in %.3f s.\n",
+        answered, connectionCount * perConnection, errors,
+        connectionCount, seconds
+    );
+    if (failed) printf("%u connections failed.\n", failed);
+    if (answered) {
+        printf("%.1f boards/s. Latency: p50 %.3f ms, p90 %.3f ms, "
+            "p99 %.3f ms, max %.3f ms.\n",
+            answered / seconds,
+            latencies[(answered - 1) / 2],
+            latencies[(uint32_t)((answered - 1) * 0.90)],
+            latencies[(uint32_t)((answered - 1) * 0.99)],
+            latencies[answered - 1]
+        );
+    }
+
+    free(latencies);
+    free(connections);
+    free(threads);
+    free(requests.data);
+    free(requests.offsets);
+
+    return answered == connectionCount * perConnection && errors == 0 ? 0 : -1;
+}
+
+
+// Turns every board in the corpus into a request:
+// text boards get a blank line after them, binary ones are sent as they are.
+int loadRequests(const char *path, requests_t *requests) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "File %s not found.\n", path);
+        return -1;
+    }
+
+    corpus_t corpus;
+    const int failed = openCorpus(file, &corpus);
+    fclose(file);
+    if (failed) return -1;
+
+    size_t length = 0;
+    size_t capacity = corpus.length + 4096;
+    uint32_t offsetCapacity = 1024;
+    requests->data = malloc(capacity);
+    requests->offsets = malloc((offsetCapacity + 1) * sizeof(size_t));
+
+    puzzleView_t puzzle;
+    while (nextPuzzle(&corpus, &puzzle)) {
+        const size_t needed = puzzle.length + puzzle.idLength + 8;
+        if (length + needed > capacity) {
+            capacity = (length + needed) * 2;
+            requests->data = realloc(requests->data, capacity);
+        }
+        if (requests->count == offsetCapacity) {
+            offsetCapacity *= 2;
+            requests->offsets = realloc(
+                requests->offsets, (offsetCapacity + 1) * sizeof(size_t)
+            );
+        }
+        requests->offsets[requests->count++] = length;
+
+        if (puzzle.id) {
+            length += sprintf(requests->data + length, "# %.*s\n",
+                puzzle.idLength, puzzle.id
+            );
+        }
+        memcpy(requests->data + length, puzzle.text, puzzle.length);
+        length += puzzle.length;
+        if (!puzzle.binary) {
+            memcpy(requests->data + length, "\n\n", 2);
+            length += 2;
+        }
+    }
+    requests->offsets[requests->count] = length;
+
+    closeCorpus(&corpus);
+
+    if (requests->count == 0) {
+        fprintf(stderr, "There are no boards in %s.\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+
+// Sends on its own thread, and reads the answers on this one.
+void *runConnection(void *arg) {
+    connection_t *connection = arg;
+    requests_t *requests = connection->requests;
+
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    strncpy(address.sun_path, requests->path, sizeof(address.sun_path) - 1);
+
+    connection->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(connection->fd, (struct sockaddr *)&address, sizeof(address))) {
+        perror("connect");
+        close(connection->fd);
+        connection->failed = 1;
+        return NULL;
+    }
+
+    pthread_t sender;
+    pthread_create(&sender, NULL, sendRequests, connection);
+
+    // Every line is the answer to the next request.
+    const uint32_t total = requests->count * requests->rounds;
+    // Quotes in IDs are escaped, so this only shows up as the error key.
+    const char errorKey[] = ",\"error\":";
+    uint32_t matched = 0;
+    uint8_t isError = 0;
+
+    char buffer[65536];
+    ssize_t got;
+    while (connection->answered < total
+        && (got = read(connection->fd, buffer, sizeof(buffer))) > 0
+    ) {
+        const uint64_t now = nanos();
+        for (ssize_t i = 0; i < got; i++) {
+            const char c = buffer[i];
+            if (c == errorKey[matched]) matched++;
+            else matched = c == errorKey[0];
+            if (matched == sizeof(errorKey) - 1) {
+                isError = 1;
+                matched = 0;
+            }
+            if (c != '\n') continue;
+
+            const uint32_t r = connection->answered++;
+            const uint64_t sent = __atomic_load_n(
+                &connection->sent[r], __ATOMIC_ACQUIRE
+            );
+            connection->latencies[r] = (now - sent) / 1e6;
+            connection->errors += isError;
+            isError = 0;
+        }
+    }
+
+    pthread_join(sender, NULL);
+    close(connection->fd);
+    return NULL;
+}
+
+
+void *sendRequests(void *arg) {
+    connection_t *connection = arg;
+    requests_t *requests = connection->requests;
+
+    uint32_t index = 0;
+    for (uint32_t round = 0; round < requests->rounds; round++) {
+        for (uint32_t r = 0; r < requests->count; r++, index++) {
+            const char *data = requests->data + requests->offsets[r];
+            size_t length = requests->offsets[r + 1] - requests->offsets[r];
+
+            __atomic_store_n(&connection->sent[index], nanos(), __ATOMIC_RELEASE);
+            while (length) {
+                ssize_t sent = write(connection->fd, data, length);
+                if (sent <= 0) {
+                    perror("write");
+                    shutdown(connection->fd, SHUT_WR);
+                    return NULL;
+                }
+                data += sent;
+                length -= sent;
+            }
+        }
+    }
+
+    // Tells the server we're done, so it closes once it answered everything.
+    shutdown(connection->fd, SHUT_WR);
+    return NULL;
+}
+
+
+uint64_t nanos(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+int compareDoubles(const void *a, const void *b) {
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,509 @@
+// Draws a board from a board file the way it looks in a browser, as a
+// screenshot to test the seeer on (see --image and --image-dir).
+// Next to OUT.ppm goes OUT.txt: the board, with a "# geometry X Y OFFSET"
+// line before it saying where detectBoard should find it
+// (like boardScreenInfo_t), which --image-dir checks.
+//
+// Usage: render-board [OPTION]... BOARD OUT.ppm
+//   --size=WIDTHxHEIGHT  The size of the screenshot. Default is 1280x900.
+//   --pitch=PIXELS       The size of a cell, can have a fraction (zoom).
+//                        Default is 50.
+//   --antialias          Draw the lines right where they fall, blurred over
+//                        two pixels with a fractional pitch. Browsers put them
+//                        on whole pixels instead, which is the default.
+//   --at=X,Y             Where the top left corner of the grid goes.
+//                        Default is the middle of the screenshot.
+//   --theme=THEME        "light" (the default) or "dark" page around it.
+//   --noise=AMOUNT       Blocky noise, a bit like a JPEG, up to AMOUNT.
+//   --clutter=COUNT      Puts COUNT random things on the page around it.
+//   --seed=SEED          For the noise and clutter.
+
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "looker.h"
+#include "ppm.h"
+#include "reader.h"
+#include "types.h"
+
+#define MIN(i, j) (((i) < (j)) ? (i) : (j))
+#define MAX(i, j) (((i) > (j)) ? (i) : (j))
+
+
+// Samples per pixel on a side, for the antialiasing.
+#define SUPERSAMPLING 4
+
+// How thick the lines are at a pitch of 50 (the default zoom).
+#define THIN_LINE 1.0
+#define THICK_LINE 3.0
+
+
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    double pitch;
+    // The top left corner of the grid.
+    double x;
+    double y;
+    uint8_t dark;
+    uint8_t antialias;
+    uint32_t noise;
+    uint32_t clutter;
+    uint32_t seed;
+    // The color of every group, from pickColors.
+    pixel_t *colors;
+} renderOptions_t;
+
+
+// The colors on the real boards.
+static const pixel_t palette[] = {
+    {.r = 255, .g = 123, .b = 96},  {.r = 150, .g = 190, .b = 255},
+    {.r = 179, .g = 223, .b = 160}, {.r = 223, .g = 223, .b = 223},
+    {.r = 187, .g = 163, .b = 226}, {.r = 255, .g = 201, .b = 146},
+    {.r = 230, .g = 243, .b = 136}, {.r = 185, .g = 178, .b = 158},
+    {.r = 223, .g = 160, .b = 191}, {.r = 163, .g = 210, .b = 216},
+    {.r = 98, .g = 239, .b = 234},  {.r = 255, .g = 147, .b = 243},
+};
+#define PALETTE_COLORS (sizeof(palette) / sizeof(pixel_t))
+
+
+static pixel_t *pickColors(board_t board);
+static pixel_t extraColor(uint32_t index);
+static image_t renderBoard(board_t board, renderOptions_t *options);
+static void drawClutter(image_t image, renderOptions_t *options, rect_t keepOut);
+static pixel_t sampleBoard(
+    board_t board, renderOptions_t *options, double x, double y
+);
+static void addNoise(image_t image, uint32_t amount);
+static void fillRect(image_t image, rect_t rect, pixel_t color);
+static int writeTruth(const char *path, board_t board, renderOptions_t *options);
+
+
+int main(int argc, char *argv[]) {
+    struct option long_options[] = {
+        {"size", required_argument, 0, 's'},
+        {"pitch", required_argument, 0, 'p'},
+        {"antialias", no_argument, 0, 'A'},
+        {"at", required_argument, 0, 'a'},
+        {"theme", required_argument, 0, 't'},
+        {"noise", required_argument, 0, 'n'},
+        {"clutter", required_argument, 0, 'c'},
+        {"seed", required_argument, 0, 'r'},
+        {0, 0, 0, 0}
+    };
+
+    renderOptions_t options = {.width = 1280, .height = 900, .pitch = 50};
+    uint8_t placed = 0;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 's':
+                if (sscanf(optarg, "%ux%u", &options.width, &options.height) != 2) {
+                    fprintf(stderr, "Could not parse size %s.\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'p':
+                options.pitch = strtod(optarg, NULL);
+                break;
+
+            case 'A':
+                options.antialias = 1;
+                break;
+
+            case 'a':
+                if (sscanf(optarg, "%lf,%lf", &options.x, &options.y) != 2) {
+                    fprintf(stderr, "Could not parse position %s.\n", optarg);
+                    return -1;
+                }
+                placed = 1;
+                break;
+
+            case 't':
+                if (strcmp(optarg, "light") == 0) options.dark = 0;
+                else if (strcmp(optarg, "dark") == 0) options.dark = 1;
+                else {
+                    fprintf(stderr, "Unknown theme %s.\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'n':
+                options.noise = strtol(optarg, NULL, 0);
+                break;
+
+            case 'c':
+                options.clutter = strtol(optarg, NULL, 0);
+                break;
+
+            case 'r':
+                options.seed = strtol(optarg, NULL, 0);
+                break;
+
+            default:
+                return -1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        fprintf(stderr, "Usage: %s [OPTION]... BOARD OUT.ppm\n", argv[0]);
+        return -1;
+    }
+    const char *boardPath = argv[optind];
+    const char *outPath = argv[optind + 1];
+    const size_t outLength = strlen(outPath);
+    if (outLength < 5 || strcmp(outPath + outLength - 4, ".ppm")) {
+        fprintf(stderr, "The output has to end in .ppm.\n");
+        return -1;
+    }
+    if (options.pitch < 4) {
+        fprintf(stderr, "A pitch of %g is too small.\n", options.pitch);
+        return -1;
+    }
+
+    FILE *file = fopen(boardPath, "r");
+    if (file == NULL) {
+        fprintf(stderr, "File %s not found.\n", boardPath);
+        return -1;
+    }
+    board_t board;
+    const int failed = readQueensFile(file, &board);
+    fclose(file);
+    if (failed) return -1;
+
+    if (!placed) {
+        options.x = (options.width - board.size * options.pitch) / 2;
+        options.y = (options.height - board.size * options.pitch) / 2;
+    }
+
+    srand(options.seed);
+    options.colors = pickColors(board);
+    image_t image = renderBoard(board, &options);
+    imageToFile(outPath, image);
+    free(image.pixels);
+
+    char truthPath[outLength + 1];
+    strcpy(truthPath, outPath);
+    strcpy(truthPath + outLength - 4, ".txt");
+    const int ret = writeTruth(truthPath, board, &options);
+
+    free(options.colors);
+    freeBoard(board);
+    return ret;
+}
+
+
+// Gives every group a color that none of the groups touching it have,
+// going through the palette first (like real boards), and making up
+// more colors if some group touches all of them.
+pixel_t *pickColors(board_t board) {
+    const uint32_t cellCount = board.size * board.size;
+    uint32_t groupCount = 0;
+    for (uint32_t i = 0; i < cellCount; i++) {
+        groupCount = MAX(groupCount, board.cells[i].color + 1);
+    }
+
+    // Which groups touch which, across the right and bottom of every cell.
+    uint8_t *touching = calloc(groupCount * groupCount, 1);
+    for (uint32_t y = 0; y < board.size; y++) {
+        for (uint32_t x = 0; x < board.size; x++) {
+            const uint32_t color = board.cells[x + y * board.size].color;
+            uint32_t neighbors[2] = {color, color};
+            if (x + 1 < board.size) {
+                neighbors[0] = board.cells[x + 1 + y * board.size].color;
+            }
+            if (y + 1 < board.size) {
+                neighbors[1] = board.cells[x + (y + 1) * board.size].color;
+            }
+            for (uint8_t i = 0; i < 2; i++) {
+                touching[color * groupCount + neighbors[i]] = 1;
+                touching[neighbors[i] * groupCount + color] = 1;
+            }
+        }
+    }
+
+    // Greedy, so a group never needs more than groupCount colors.
+    uint32_t picked[groupCount];
+    uint8_t taken[groupCount];
+    pixel_t *colors = malloc(groupCount * sizeof(pixel_t));
+    for (uint32_t group = 0; group < groupCount; group++) {
+        memset(taken, 0, groupCount);
+        for (uint32_t other = 0; other < group; other++) {
+            if (touching[group * groupCount + other]) taken[picked[other]] = 1;
+        }
+
+        picked[group] = 0;
+        while (taken[picked[group]]) picked[group]++;
+        colors[group] = picked[group] < PALETTE_COLORS
+            ? palette[picked[group]]
+            : extraColor(picked[group] - PALETTE_COLORS);
+    }
+
+    free(touching);
+    return colors;
+}
+
+
+// Pastel colors with their hues spread around the color wheel,
+// for when the palette runs out.
+pixel_t extraColor(uint32_t index) {
+    const double hue = fmod(index * 0.618034, 1) * 6;
+    const double value = index % 2 ? 200 : 250;
+    const double low = value * 0.5;
+    const double rising = low + (value - low) * (hue - floor(hue));
+    const double falling = value - (value - low) * (hue - floor(hue));
+
+    double rgb[3];
+    switch ((int)hue) {
+        case 0: rgb[0] = value; rgb[1] = rising; rgb[2] = low; break;
+        case 1: rgb[0] = falling; rgb[1] = value; rgb[2] = low; break;
+        case 2: rgb[0] = low; rgb[1] = value; rgb[2] = rising; break;
+        case 3: rgb[0] = low; rgb[1] = falling; rgb[2] = value; break;
+        case 4: rgb[0] = rising; rgb[1] = low; rgb[2] = value; break;
+        default: rgb[0] = value; rgb[1] = low; rgb[2] = falling; break;
+    }
+    return (pixel_t){.r = rgb[0], .g = rgb[1], .b = rgb[2]};
+}
+
+
+image_t renderBoard(board_t board, renderOptions_t *options) {
+    image_t image = {
+        .width = options->width,
+        .height = options->height,
+        .stride = options->width,
+        .pixels = malloc(options->width * options->height * sizeof(pixel_t)),
+    };
+
+    const pixel_t page = options->dark
+        ? (pixel_t){.r = 27, .g = 31, .b = 35}
+        : (pixel_t){.r = 243, .g = 242, .b = 239};
+    const pixel_t card = options->dark
+        ? (pixel_t){.r = 56, .g = 60, .b = 66}
+        : (pixel_t){.r = 255, .g = 255, .b = 255};
+    fillRect(image, (rect_t){0, 0, image.width, image.height}, page);
+
+    // The board sits on a card, with some room around it.
+    const double gridSize = board.size * options->pitch;
+    const double margin = options->pitch / 2 + THICK_LINE;
+    const rect_t cardRect = {
+        floor(options->x - margin), floor(options->y - margin),
+        ceil(gridSize + 2 * margin), ceil(gridSize + 2 * margin)
+    };
+    drawClutter(image, options, cardRect);
+    fillRect(image, cardRect, card);
+
+    // Every pixel the board touches is the average of its samples.
+    const double border = THICK_LINE * options->pitch / 50;
+    const int32_t left = MAX(floor(options->x - border), 0);
+    const int32_t top = MAX(floor(options->y - border), 0);
+    const int32_t right = MIN(ceil(options->x + gridSize + border), image.width);
+    const int32_t bottom = MIN(
+        ceil(options->y + gridSize + border), image.height
+    );
+
+    for (int32_t y = top; y < bottom; y++) {
+        for (int32_t x = left; x < right; x++) {
+            pixel_t *pixel = image.pixels + x + y * image.stride;
+            uint32_t r = 0, g = 0, b = 0;
+            uint32_t inside = 0;
+
+            for (uint32_t sy = 0; sy < SUPERSAMPLING; sy++) {
+                for (uint32_t sx = 0; sx < SUPERSAMPLING; sx++) {
+                    const double px = x + (sx + 0.5) / SUPERSAMPLING;
+                    const double py = y + (sy + 0.5) / SUPERSAMPLING;
+                    pixel_t sample = sampleBoard(board, options, px, py);
+                    // Off the board, the card shows through.
+                    if (sample.x) sample = *pixel;
+                    else inside++;
+                    r += sample.r;
+                    g += sample.g;
+                    b += sample.b;
+                }
+            }
+
+            if (inside == 0) continue;
+            const uint32_t samples = SUPERSAMPLING * SUPERSAMPLING;
+            *pixel = (pixel_t){
+                .r = r / samples, .g = g / samples, .b = b / samples
+            };
+        }
+    }
+
+    if (options->noise) addNoise(image, options->noise);
+
+    return image;
+}
+
+
+// Random blocks, lines of "text", and long rules, like on a web page.
+// None of it goes in keepOut.
+void drawClutter(image_t image, renderOptions_t *options, rect_t keepOut) {
+    const pixel_t ink = options->dark
+        ? (pixel_t){.r = 230, .g = 230, .b = 230}
+        : (pixel_t){.r = 0, .g = 0, .b = 0};
+
+    for (uint32_t i = 0; i < options->clutter; i++) {
+        rect_t rect = {rand() % image.width, rand() % image.height, 0, 0};
+        pixel_t color = ink;
+
+        switch (rand() % 3) {
+        case 0:
+            // A picture or a button.
+            rect.width = 20 + rand() % 200;
+            rect.height = 20 + rand() % 120;
+            color = palette[rand() % PALETTE_COLORS];
+            break;
+        case 1:
+            // A line of text, one "letter" at a time.
+            rect.width = 40 + rand() % 300;
+            rect.height = 8 + rand() % 8;
+            break;
+        case 2:
+            // A divider, as long as the lines of a grid.
+            rect.width = 100 + rand() % 400;
+            rect.height = 1 + rand() % 2;
+            color = (pixel_t){0};
+            break;
+        }
+
+        if (
+            rect.x < keepOut.x + (int32_t)keepOut.width
+            && keepOut.x < rect.x + (int32_t)rect.width
+            && rect.y < keepOut.y + (int32_t)keepOut.height
+            && keepOut.y < rect.y + (int32_t)rect.height
+        ) continue;
+
+        if (rect.height >= 8 && color.value == ink.value) {
+            for (int32_t x = rect.x; x < rect.x + (int32_t)rect.width; ) {
+                const int32_t letter = 2 + rand() % 7;
+                fillRect(image, (rect_t){x, rect.y, letter, rect.height}, color);
+                x += letter + 2 + rand() % 4;
+            }
+        }
+        else fillRect(image, rect, color);
+    }
+}
+
+
+// The color of the board at a point, without any antialiasing.
+// Points off the board come back with x set.
+pixel_t sampleBoard(
+    board_t board, renderOptions_t *options, double x, double y
+) {
+    const int32_t size = board.size;
+    const double scale = options->pitch / 50;
+    const double thin = MAX(THIN_LINE * scale, 1) / 2;
+    const double thick = MAX(THICK_LINE * scale, 2) / 2;
+
+    // In cells.
+    const double u = (x - options->x) / options->pitch;
+    const double v = (y - options->y) / options->pitch;
+    const int32_t column = MIN(MAX((int32_t)floor(u), 0), size - 1);
+    const int32_t row = MIN(MAX((int32_t)floor(v), 0), size - 1);
+
+    // The closest line both ways, and how far it is in pixels.
+    // Lines go through the middle of pixels, so they're sharp.
+    const double lineU = u - 0.5 / options->pitch;
+    const double lineV = v - 0.5 / options->pitch;
+    const int32_t lineX = lround(lineU);
+    const int32_t lineY = lround(lineV);
+    double distanceX = fabs(lineU - lineX) * options->pitch;
+    double distanceY = fabs(lineV - lineY) * options->pitch;
+    if (!options->antialias) {
+        distanceX = fabs(x - 0.5 - round(options->x + lineX * options->pitch));
+        distanceY = fabs(y - 0.5 - round(options->y + lineY * options->pitch));
+    }
+
+    // Lines are thick around the board, and between groups.
+    uint8_t thickX = lineX <= 0 || lineX >= size;
+    if (!thickX) {
+        thickX = board.cells[lineX - 1 + row * size].color
+            != board.cells[lineX + row * size].color;
+    }
+    uint8_t thickY = lineY <= 0 || lineY >= size;
+    if (!thickY) {
+        thickY = board.cells[column + (lineY - 1) * size].color
+            != board.cells[column + lineY * size].color;
+    }
+
+    const uint8_t onLine = distanceX <= (thickX ? thick : thin)
+        || distanceY <= (thickY ? thick : thin);
+    const uint8_t onBoard = u >= 0 && u < size && v >= 0 && v < size;
+
+    // The outer border sticks out a bit.
+    const double outside = MAX(
+        MAX(-lineU, lineU - size), MAX(-lineV, lineV - size)
+    ) * options->pitch;
+    if (!onBoard && (!onLine || outside > thick)) return (pixel_t){.x = 1};
+
+    if (onLine) return (pixel_t){0};
+    return options->colors[board.cells[column + row * size].color];
+}
+
+
+// Every 8x8 block gets a bit brighter or darker, and every pixel
+// a bit of its own on top.
+void addNoise(image_t image, uint32_t amount) {
+    for (uint32_t blockY = 0; blockY < image.height; blockY += 8) {
+        for (uint32_t blockX = 0; blockX < image.width; blockX += 8) {
+            const int32_t shift = rand() % (amount + 1) - (int32_t)amount / 2;
+
+            for (uint32_t y = blockY; y < MIN(blockY + 8, image.height); y++) {
+                for (uint32_t x = blockX; x < MIN(blockX + 8, image.width); x++) {
+                    pixel_t *pixel = image.pixels + x + y * image.stride;
+                    uint8_t *channels[3] = {&pixel->r, &pixel->g, &pixel->b};
+                    for (uint8_t c = 0; c < 3; c++) {
+                        const int32_t value = *channels[c] + shift
+                            + rand() % (amount + 1) - (int32_t)amount / 2;
+                        *channels[c] = MIN(MAX(value, 0), 255);
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+void fillRect(image_t image, rect_t rect, pixel_t color) {
+    const int32_t right = MIN(rect.x + (int32_t)rect.width, (int32_t)image.width);
+    const int32_t bottom = MIN(rect.y + (int32_t)rect.height, (int32_t)image.height);
+    for (int32_t y = MAX(rect.y, 0); y < bottom; y++) {
+        for (int32_t x = MAX(rect.x, 0); x < right; x++) {
+            image.pixels[x + y * image.stride] = color;
+        }
+    }
+}
+
+
+// Where detectBoard should find the board, and the board itself.
+// The geometry is the middle of the top left cell and the pitch,
+// like boardScreenInfo_t.
+int writeTruth(const char *path, board_t board, renderOptions_t *options) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Couldn't open %s.\n", path);
+        return -1;
+    }
+
+    fprintf(file, "# geometry %ld %ld %ld\n",
+        lround(options->x + options->pitch / 2),
+        lround(options->y + options->pitch / 2),
+        lround(options->pitch)
+    );
+    for (uint32_t y = 0; y < board.size; y++) {
+        for (uint32_t x = 0; x < board.size; x++) {
+            const uint32_t color = board.cells[x + y * board.size].color;
+            if (board.size <= 26) fprintf(file, "%c", 'a' + color);
+            else fprintf(file, "%u", color);
+            fprintf(file, x + 1 < board.size ? " " : "\n");
+        }
+    }
+
+    return fclose(file) ? -1 : 0;
+}
@@ -0,0 +1,98 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "tuning.h"
+
+
+// Boards can't be bigger than this anyway (colors are single bytes).
+#define MAX_TUNED_SIZE 256
+
+
+// Shared between all solving threads, so it's behind a lock.
+static pthread_mutex_t tuningLock = PTHREAD_MUTEX_INITIALIZER;
+static double searchCosts[MAX_TUNED_SIZE];
+static uint8_t tuningChanged;
+
+
+void loadTuning(const char *path) {
+    if (path == NULL) return;
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return;
+
+    pthread_mutex_lock(&tuningLock);
+
+    // One "size cost" pair per line.
+    uint32_t size;
+    double cost;
+    while (fscanf(file, "%u %lf", &size, &cost) == 2) {
+        if (size < MAX_TUNED_SIZE && cost > 0) searchCosts[size] = cost;
+    }
+
+    pthread_mutex_unlock(&tuningLock);
+    fclose(file);
+}
+
+
+int saveTuning(const char *path) {
+    if (path == NULL) return 0;
+
+    pthread_mutex_lock(&tuningLock);
+
+    if (!tuningChanged) {
+        pthread_mutex_unlock(&tuningLock);
+        return 0;
+    }
+
+    // Write it somewhere else first, so a crash can't leave half a file.
+    char tmpPath[PATH_MAX];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+
+    FILE *file = fopen(tmpPath, "w");
+    if (file == NULL) {
+        pthread_mutex_unlock(&tuningLock);
+        return -1;
+    }
+
+    for (uint32_t size = 0; size < MAX_TUNED_SIZE; size++) {
+        if (searchCosts[size] > 0) {
+            fprintf(file, "%u %.3f\n", size, searchCosts[size]);
+        }
+    }
+    fclose(file);
+
+    tuningChanged = 0;
+    pthread_mutex_unlock(&tuningLock);
+
+    return rename(tmpPath, path);
+}
+
+
+double getSearchCost(uint32_t size) {
+    if (size >= MAX_TUNED_SIZE) return 0;
+
+    pthread_mutex_lock(&tuningLock);
+    double cost = searchCosts[size];
+    pthread_mutex_unlock(&tuningLock);
+
+    return cost;
+}
+
+
+void learnSearchCost(uint32_t size, double nsPerCell) {
+    if (size >= MAX_TUNED_SIZE || nsPerCell <= 0) return;
+
+    pthread_mutex_lock(&tuningLock);
+
+    // A running average, so one weird board doesn't throw everything off.
+    if (searchCosts[size] == 0) searchCosts[size] = nsPerCell;
+    else {
+        searchCosts[size] = (1 - TUNING_WEIGHT) * searchCosts[size]
+            + TUNING_WEIGHT * nsPerCell;
+    }
+    tuningChanged = 1;
+
+    pthread_mutex_unlock(&tuningLock);
+}
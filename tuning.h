@@ -0,0 +1,26 @@
+#ifndef TUNING_H
+#define TUNING_H
+
+#include <stdint.h>
+
+
+// A good place to keep the learned thresholds, relative to $HOME.
+#define TUNING_FILE ".queens-tuning"
+
+// How much a new measurement counts towards the learned value.
+#define TUNING_WEIGHT 0.25
+
+
+// Reads the learned thresholds from a file (if path isn't NULL).
+// A missing file just means nothing has been learned yet.
+void loadTuning(const char *path);
+// Writes the learned thresholds back, if anything changed.
+int saveTuning(const char *path);
+
+// Returns what bruteforcing costs (in ns) per cell that is still in the
+// running when it starts, for boards of this size. 0 if unknown.
+double getSearchCost(uint32_t size);
+void learnSearchCost(uint32_t size, double nsPerCell);
+
+
+#endif // TUNING_H
@@ -1,10 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "types.h"
 #include "debug_prints.h"
 
 void freeBoard(board_t board);
+static void buildConflicts(board_t board);
 
 
 board_t createBoard(uint32_t size) {
@@ -20,12 +22,18 @@ board_t createBoard(uint32_t size) {
     ret.set_arrays[1] = sets + size;
     ret.set_arrays[2] = sets + 2 * size;
 
+    // The table itself gets filled in by colorBoard,
+    // since it depends on the groups.
+    ret.conflicts = calloc(1, sizeof(conflicts_t));
+    ret.conflicts->refCount = 1;
+
     // Populate the set arrays.
     for (uint32_t i = 0; i < size; i++) {
 
         // Populate the columns with cells.
         ret.columns[i].cells = calloc(size, sizeof(cell_t*));
         ret.columns[i].cellCount = size;
+        ret.columns[i].capacity = size;
         ret.columns[i].identifier = i;
         for (uint32_t j = 0; j < size; j++) {
             ret.columns[i].cells[j] = &ret.cells[j * size + i];
@@ -34,6 +42,7 @@ board_t createBoard(uint32_t size) {
         // Populate the rows with cells.
         ret.rows[i].cells = calloc(size, sizeof(cell_t*));
         ret.rows[i].cellCount = size;
+        ret.rows[i].capacity = size;
         ret.rows[i].identifier = i;
         for (uint32_t j = 0; j < size; j++) {
             ret.rows[i].cells[j] = &ret.cells[i * size + j];
@@ -58,6 +67,8 @@ board_t createBoard(uint32_t size) {
             cell->y = j;
             cell->column = &ret.columns[i];
             cell->row = &ret.rows[j];
+            cell->slots[0] = j;
+            cell->slots[1] = i;
         }
     }
 
@@ -86,6 +97,17 @@ void freeBoard(board_t board) {
     free(board.cells);
     // Cells don't contain any heap pointers so they don't need special care.
 
+    // The conflict table might still be used by other copies.
+    conflicts_t *conflicts = board.conflicts;
+    if (--conflicts->refCount == 0) {
+        free(conflicts->offsets);
+        free(conflicts->indices);
+        free(conflicts->masks);
+        free(conflicts->corners);
+        free(conflicts->cornerCounts);
+        free(conflicts);
+    }
+
 }
 
 // Returns a copy of the input board, with new arrays.
@@ -94,6 +116,12 @@ board_t copyBoard(board_t board) {
     const uint32_t size = board.size;
 
     board_t copy = createBoard(size);
+
+    // The conflict table never changes, so the copy can just share it.
+    free(copy.conflicts);
+    copy.conflicts = board.conflicts;
+    copy.conflicts->refCount++;
+
     for (uint32_t c = 0; c < size * size; c++) {
         copy.cells[c].color = board.cells[c].color;
         copy.cells[c].type = board.cells[c].type;
@@ -103,17 +131,21 @@ board_t copyBoard(board_t board) {
 
     for (uint32_t i = 0; i < size; i++) {
         copy.groups[i].cells = malloc(
-            board.groups[i].cellCount * sizeof(cell_t*)
+            board.groups[i].capacity * sizeof(cell_t*)
         );
+        copy.groups[i].capacity = board.groups[i].capacity;
     }
 
+    // Copy the whole arrays, crossed cells included,
+    // so the copy's cells can be uncrossed just like the original's.
     for (uint32_t s = 0; s < 3; s++) {
         for (uint32_t i = 0; i < size; i++) {
             cellSet_t *set = &copy.set_arrays[s][i];
             set->cellCount = board.set_arrays[s][i].cellCount;
-            for (uint32_t c = 0; c < set->cellCount; c++) {
+            for (uint32_t c = 0; c < set->capacity; c++) {
                 cell_t *bCell = board.set_arrays[s][i].cells[c];
                 set->cells[c] = &copy.cells[bCell->x + bCell->y * size];
+                set->cells[c]->slots[s] = c;
             }
             copy.set_arrays[s][i].solved = board.set_arrays[s][i].solved;
         }
@@ -139,42 +171,35 @@ void cleanSet(cellSet_t *set) {
     set->cellCount = empty_i;
 }
 
-// Returns the 4 diagonally adjacent cells to a cell.
-corners_t getCorners(board_t board, cell_t cell) {
+// Returns the diagonally adjacent cells to a cell that aren't crossed.
+corners_t getCorners(board_t board, cell_t *cell) {
     corners_t corners = {0};
 
-    uint8_t corner_index = 0;
-    int8_t x[4] = {-1, 1, -1, 1};
-    int8_t y[4] = {-1, -1, 1, 1};
-
-    for (uint8_t i = 0; i < 4; i++) {
-        // Check if the corner is in bounds.
-        int32_t newX = cell.x + x[i];
-        int32_t newY = cell.y + y[i];
-
-        // This has to be a pointer because its index could be
-        // outside the bounds of the board's cells array.
-        // If it wasn't a pointer, C would try to copy the contents
-        // of the array entry into this variable, which could result
-        // in a segfault.
-        cell_t *corner = &board.cells[newY * board.size + newX];
-
-        if ( // Thank you short-circuiting, my hero.
-            newX < 0 || newX >= board.size
-            || newY < 0 || newY >= board.size
-            || corner->type == CELL_CROSSED
-        ) continue;
-
-        // Having it be a pointer is also nice for this tbh.
-        corners.cells[corner_index++] = corner;
-    }
+    const uint32_t index = cell->x + cell->y * board.size;
+    const conflicts_t *conflicts = board.conflicts;
 
-    corners.count = corner_index;
+    for (uint8_t i = 0; i < conflicts->cornerCounts[index]; i++) {
+        cell_t *corner = &board.cells[conflicts->corners[index][i]];
+        if (corner->type == CELL_CROSSED) continue;
+
+        corners.cells[corners.count++] = corner;
+    }
 
     return corners;
 }
 
 
+// Returns 1 if a queen on cell a would rule out cell b (and vice versa).
+uint8_t inConflict(board_t board, cell_t *a, cell_t *b) {
+    const conflicts_t *conflicts = board.conflicts;
+    const uint32_t aIndex = a->x + a->y * board.size;
+    const uint32_t bIndex = b->x + b->y * board.size;
+
+    const uint64_t *mask = &conflicts->masks[aIndex * conflicts->maskWords];
+    return (mask[bIndex / 64] >> (bIndex % 64)) & 1;
+}
+
+
 void colorBoard(board_t board, uint32_t *colors) {
     // Populate group and color fields in the cells,
     // and count the cells for every group.
@@ -196,32 +221,145 @@ void colorBoard(board_t board, uint32_t *colors) {
     for (uint32_t i = 0; i < board.size * board.size; i++) {
         cellSet_t *group = &board.groups[colors[i]];
         group->cells[group->cellCount] = &board.cells[i];
+        board.cells[i].slots[2] = group->cellCount;
         group->cellCount++;
     }
 
+    // The +1 from the counts starting at -1 is spare, not a crossed cell.
+    for (uint32_t i = 0; i < board.size; i++) {
+        board.groups[i].capacity = board.groups[i].cellCount;
+    }
+
+    buildConflicts(board);
+}
+
+
+// Fills in the board's conflict table.
+// The groups need to be known for this, so it's done by colorBoard.
+static void buildConflicts(board_t board) {
+    const uint32_t size = board.size;
+    const uint32_t cellCount = size * size;
+    conflicts_t *conflicts = board.conflicts;
+
+    conflicts->maskWords = (cellCount + 63) / 64;
+    conflicts->masks = calloc(
+        cellCount * conflicts->maskWords, sizeof(uint64_t)
+    );
+    conflicts->offsets = malloc((cellCount + 1) * sizeof(uint32_t));
+    conflicts->corners = malloc(cellCount * sizeof(*conflicts->corners));
+    conflicts->cornerCounts = calloc(cellCount, sizeof(uint8_t));
+
+    #define SET_BIT(mask, bit) ((mask)[(bit) / 64] |= 1ull << ((bit) % 64))
+
+    // First build the masks. Cells can be in more than one of the
+    // conflicting sets, so this is also what gets rid of duplicates.
+    uint32_t total = 0;
+    for (uint32_t c = 0; c < cellCount; c++) {
+        cell_t *cell = &board.cells[c];
+        uint64_t *mask = &conflicts->masks[c * conflicts->maskWords];
+
+        for (uint32_t i = 0; i < size; i++) {
+            SET_BIT(mask, cell->x + i * size);
+            SET_BIT(mask, i + cell->y * size);
+        }
+        for (uint32_t i = 0; i < cell->group->cellCount; i++) {
+            cell_t *member = cell->group->cells[i];
+            SET_BIT(mask, member->x + member->y * size);
+        }
+
+        for (int32_t dy = -1; dy <= 1; dy++) {
+            for (int32_t dx = -1; dx <= 1; dx++) {
+                int32_t newX = cell->x + dx;
+                int32_t newY = cell->y + dy;
+                if (newX < 0 || newX >= size || newY < 0 || newY >= size)
+                    continue;
+
+                SET_BIT(mask, newX + newY * size);
+
+                if (dx != 0 && dy != 0) {
+                    conflicts->corners[c][conflicts->cornerCounts[c]++] =
+                        newX + newY * size;
+                }
+            }
+        }
+
+        // A cell doesn't conflict with itself.
+        mask[c / 64] &= ~(1ull << (c % 64));
+
+        conflicts->offsets[c] = total;
+        for (uint32_t w = 0; w < conflicts->maskWords; w++) {
+            total += __builtin_popcountll(mask[w]);
+        }
+    }
+    conflicts->offsets[cellCount] = total;
+
+    #undef SET_BIT
+
+    // Then turn the masks into index lists.
+    conflicts->indices = malloc(total * sizeof(uint32_t));
+    for (uint32_t c = 0; c < cellCount; c++) {
+        uint64_t *mask = &conflicts->masks[c * conflicts->maskWords];
+        uint32_t *index = &conflicts->indices[conflicts->offsets[c]];
+
+        for (uint32_t w = 0; w < conflicts->maskWords; w++) {
+            uint64_t word = mask[w];
+            while (word) {
+                *index++ = w * 64 + __builtin_ctzll(word);
+                word &= word - 1;
+            }
+        }
+    }
 }
 
 #undef DEBUG_PRINT_MODE
 #define DEBUG_PRINT_MODE PRINT_CROSSINGS
 
+// Removes the cell from all of its sets.
+// It swaps places with the last cell that's still in the running,
+// so the crossed cells pile up behind cellCount (and can be brought back).
 void crossCell(cell_t *cell) {
     DPRINTF("Crossing cell [\x1b[90m%d, %d\x1b[0m]\n", cell->x, cell->y);
 
+    if (cell->type == CELL_CROSSED) return;
     cell->type = CELL_CROSSED;
 
     for (uint8_t s = 0; s < 3; s++) {
         cellSet_t *set = cell->sets[s];
 
-        for (uint32_t c = 0; c < set->cellCount; c++) {
-            if (set->cells[c] == cell) {
-                // Move the last cell of the set into
-                // the newly created hole.
-                set->cells[c] = set->cells[set->cellCount - 1];
-                set->cellCount--;
-                // TODO: Check for queens!
-                break;
-            }
-        }
+        const uint32_t slot = cell->slots[s];
+        const uint32_t last = set->cellCount - 1;
+        cell_t *lastCell = set->cells[last];
+
+        set->cells[slot] = lastCell;
+        lastCell->slots[s] = slot;
+        set->cells[last] = cell;
+        cell->slots[s] = last;
+
+        set->cellCount--;
+    }
+}
+
+
+// Puts a crossed cell back into all of its sets.
+// Cells can be uncrossed in any order.
+void uncrossCell(cell_t *cell) {
+    if (cell->type != CELL_CROSSED) return;
+    cell->type = CELL_EMPTY;
+
+    for (uint8_t s = 0; s < 3; s++) {
+        cellSet_t *set = cell->sets[s];
+
+        // Swap it with the first crossed cell.
+        const uint32_t slot = cell->slots[s];
+        const uint32_t first = set->cellCount;
+        cell_t *firstCell = set->cells[first];
+
+        set->cells[slot] = firstCell;
+        firstCell->slots[s] = slot;
+        set->cells[first] = cell;
+        cell->slots[s] = first;
+
+        set->cellCount++;
     }
 }
 
@@ -237,12 +375,14 @@ uint8_t inSet(cellSet_t *set, cell_t* cell) {
 }
 
 
+// Returns nonzero if a set has run out of cells,
+// which means the board can't be solved anymore.
 uint8_t checkBoard(board_t board) {
     for (uint32_t i = 0; i < board.size; i++) {
         if (
-            board.columns[i].variable
-            || board.rows[i].variable
-            || board.groups[i].variable
+            board.columns[i].cellCount <= 0
+            || board.rows[i].cellCount <= 0
+            || board.groups[i].cellCount <= 0
         ) return -1;
     }
 
@@ -250,84 +390,84 @@ uint8_t checkBoard(board_t board) {
 }
 
 
-uint8_t checkSets(board_t board) {
-    for (uint32_t i = 0; i < board.size; i++) {
-        if (
-            board.columns[i].cellCount <= 0
-            || board.rows[i].cellCount <= 0
-            || board.groups[i].cellCount <= 0
-        ) return -1;
-    }
+// Scratch space fits any board of the same size as the given one.
+scratch_t createScratch(board_t board) {
+    scratch_t scratch = {0};
 
-    return 0;
+    scratch.epoch = 1;
+    scratch.setCount = board.size * 3;
+    scratch.setStamps = calloc(scratch.setCount, sizeof(uint32_t));
+    scratch.setMarks = calloc(scratch.setCount, sizeof(int32_t));
+
+    return scratch;
 }
 
 
-void printBoard(board_t board, uint32_t indentation) {
+void freeScratch(scratch_t scratch) {
+    free(scratch.setStamps);
+    free(scratch.setMarks);
+}
 
-    if (board.size == 0) {
-        fprintf(stderr, "Board has size 0??? I can't print that!!\n");
-    }
 
-    for (uint8_t t = 0; t < indentation; t++) printf("\t");
-    printf("   ");
-    for (uint32_t i = 0; i < board.size; i++) {
-        printf("%2d", i);
+// Forgets all marks.
+void nextEpoch(scratch_t *scratch) {
+    scratch->epoch++;
+
+    // Once every four billion probes the stamps need actual clearing,
+    // otherwise ancient marks would come back to life.
+    if (scratch->epoch == 0) {
+        memset(scratch->setStamps, 0, scratch->setCount * sizeof(uint32_t));
+        scratch->epoch = 1;
     }
-    printf("\n");
+}
 
-    char typeChars[] = {'o', '.', 'Q', 'M'};
-    uint32_t textColors[] = {
-        31, 32, 33, 34, 35, 36, 37, 90, 91, 92, 93, 94, 95, 96, 97
-    };
 
-    for (uint32_t j = 0; j < board.size; j++) {
-        for (uint8_t t = 0; t < indentation; t++) printf("\t");
-        printf("\x1b[%dm%2d ", textColors[j], j);
-        for (uint32_t i = 0; i < board.size; i++) {
-            if (board.cells[j * board.size + i].type > 3) {
-                printf("\x1b[%dm E",
-                    textColors[board.cells[j * board.size + i].color]
-                );
-            }
-            else {
-                printf("\x1b[%dm %c",
-                    textColors[board.cells[j * board.size + i].color],
-                    typeChars[board.cells[j * board.size + i].type]
-                );
-            }
-        }
-        printf("\n\x1b[0m");
+// Returns a pointer to the set's mark, which is 0 if it wasn't
+// touched since the last call to nextEpoch.
+int32_t *getSetMark(scratch_t *scratch, board_t board, cellSet_t *set) {
+    // The three set arrays are consecutive, see createBoard.
+    const uint32_t index = set - board.set_arrays[0];
+
+    if (scratch->setStamps[index] != scratch->epoch) {
+        scratch->setStamps[index] = scratch->epoch;
+        scratch->setMarks[index] = 0;
     }
 
+    return &scratch->setMarks[index];
 }
 
 
-void printBoardVars(board_t board) {
+void printBoard(board_t board, uint32_t indentation) {
+
+    if (board.size == 0) {
+        fprintf(stderr, "Board has size 0??? I can't print that!!\n");
+    }
 
+    for (uint8_t t = 0; t < indentation; t++) printf("\t");
     printf("   ");
     for (uint32_t i = 0; i < board.size; i++) {
         printf("%2d", i);
     }
     printf("\n");
 
+    char typeChars[] = {'o', '.', 'Q', 'M'};
     uint32_t textColors[] = {
         31, 32, 33, 34, 35, 36, 37, 90, 91, 92, 93, 94, 95, 96, 97
     };
+    // Big boards go around the colors again.
+    const uint32_t colorCount = sizeof(textColors) / sizeof(*textColors);
 
     for (uint32_t j = 0; j < board.size; j++) {
-        printf("\x1b[%dm%2d ", textColors[j], j);
+        for (uint8_t t = 0; t < indentation; t++) printf("\t");
+        printf("\x1b[%dm%2d ", textColors[j % colorCount], j);
         for (uint32_t i = 0; i < board.size; i++) {
-            if (board.cells[j * board.size + i].type == CELL_CROSSED) {
-                printf("\x1b[%dm .",
-                    textColors[board.cells[j * board.size + i].color]
-                );
+            const cell_t *cell = &board.cells[j * board.size + i];
+            const uint32_t textColor = textColors[cell->color % colorCount];
+            if (cell->type > 3) {
+                printf("\x1b[%dm E", textColor);
             }
             else {
-                printf("\x1b[%dm %d",
-                    textColors[board.cells[j * board.size + i].color],
-                    board.cells[j * board.size + i].variable
-                );
+                printf("\x1b[%dm %c", textColor, typeChars[cell->type]);
             }
         }
         printf("\n\x1b[0m");
@@ -23,10 +23,10 @@ typedef struct {
     uint32_t y;
     uint8_t type;
 
-    // Useful variable used for various things.
-    // Always set back to 0 at the end of a function using it.
-    uint16_t variable;
-    
+    // Where the cell is in each of its sets' cell arrays,
+    // so it can be found without searching.
+    uint32_t slots[3];
+
     // God fuck I love C's anonymous structs and unions.
     union {
         struct {
@@ -46,19 +46,41 @@ typedef struct {
 struct cellSet_struct{
     uint32_t identifier;
 
-    // Pointer to the array of pointers to cells that are in this group
+    // Pointer to the array of pointers to cells that are in this group.
+    // The first cellCount cells are still in the running,
+    // the crossed ones get moved behind those (see crossCell).
     cell_t **cells;
     int32_t cellCount;
+    uint32_t capacity;
 
     uint8_t solved;
-
-    // Handy variable to keep around.
-    // Used by functions for various things.
-    // Assumed to always be set back to 0.
-    int16_t variable;
 };
 
 
+// Every cell another cell rules out when it becomes a queen:
+// its column, row, and group, plus the cells a king's move away.
+// This never changes while solving, so it is built once (by colorBoard)
+// and shared between a board and all of its copies.
+typedef struct {
+    // The conflicts of cell i are
+    // indices[offsets[i]] up to (not including) indices[offsets[i + 1]].
+    uint32_t *offsets;
+    uint32_t *indices;
+
+    // The same thing as a bitmask of maskWords words per cell,
+    // with bit j set if cell j conflicts with the cell.
+    uint64_t *masks;
+    uint32_t maskWords;
+
+    // The (at most four) diagonally adjacent cells of every cell.
+    uint32_t (*corners)[4];
+    uint8_t *cornerCounts;
+
+    // Amount of boards using this table.
+    uint32_t refCount;
+} conflicts_t;
+
+
 typedef struct {
 
     // Size is the amount of columns, rows, groups, and queens,
@@ -79,6 +101,8 @@ typedef struct {
         cellSet_t *set_arrays[3];
     };
 
+    conflicts_t *conflicts;
+
 } board_t;
 
 
@@ -88,20 +112,38 @@ typedef struct {
 } corners_t;
 
 
+// Scratch space used while probing a board, kept apart from the board
+// so probes don't have to clean up after themselves.
+// A set's mark only counts if its stamp equals the current epoch,
+// so forgetting all marks is just a matter of bumping the epoch.
+typedef struct {
+    uint32_t epoch;
+    uint32_t setCount;
+    uint32_t *setStamps;
+    int32_t *setMarks;
+} scratch_t;
+
+
 board_t createBoard(uint32_t size);
 void freeBoard(board_t board);
 board_t copyBoard(board_t board);
-corners_t getCorners(board_t board, cell_t cell);
+corners_t getCorners(board_t board, cell_t *cell);
+uint8_t inConflict(board_t board, cell_t *a, cell_t *b);
 void crossCell(cell_t *cell);
+void uncrossCell(cell_t *cell);
 uint8_t inSet(cellSet_t *set, cell_t* cell);
 void colorBoard(board_t board, uint32_t *colors);
 
+scratch_t createScratch(board_t board);
+void freeScratch(scratch_t scratch);
+void nextEpoch(scratch_t *scratch);
+int32_t *getSetMark(scratch_t *scratch, board_t board, cellSet_t *set);
+
 uint8_t checkBoard(board_t board);
 void visuPrompt(board_t board, cell_t *cell, cell_t *markCell, cellSet_t *markSet);
 
 
 void printBoard(board_t board, uint32_t indentation);
-void printBoardVars(board_t board);
 
 
 #endif
\ No newline at end of file
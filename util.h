@@ -0,0 +1,15 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+
+// FNV-1a hash of the data, the checksum the binary and checkpoint formats use.
+uint32_t fnv1a(const uint8_t *data, size_t length);
+
+// Milliseconds since start (from CLOCK_MONOTONIC).
+uint64_t millisSince(struct timespec start);
+
+#endif
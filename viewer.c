@@ -0,0 +1,207 @@
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "corpus.h"
+#include "looker.h"
+#include "ppm.h"
+#include "reader.h"
+#include "seeer.h"
+#include "types.h"
+#include "viewer.h"
+
+
+static uint8_t isRightBoard(
+    const char *path, uint32_t size, uint32_t *colors,
+    boardScreenInfo_t screenInfo
+);
+static void renumberGroups(uint32_t *groups, uint32_t count);
+static int compareStrings(const void *a, const void *b);
+
+
+uint32_t detectImage(
+    const char *path, uint32_t **colors, uint8_t **marks,
+    boardScreenInfo_t *screenInfo, detectOptions_t *options, double *ms
+) {
+    image_t image;
+    if (imageFromFile(path, &image)) return 0;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    *screenInfo = (boardScreenInfo_t){0};
+    uint32_t size = detectBoard(image, colors, marks, screenInfo, options);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *ms = (end.tv_sec - start.tv_sec) * 1e3
+        + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+    freeImage(image);
+    return size;
+}
+
+
+int detectImageDir(const char *path, detectOptions_t *options) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        fprintf(stderr, "Couldn't open directory %s.\n", path);
+        return -1;
+    }
+
+    // Every PPM, sorted by name.
+    uint32_t fileCount = 0;
+    uint32_t capacity = 64;
+    char **files = malloc(capacity * sizeof(char*));
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const size_t length = strlen(entry->d_name);
+        if (length < 5 || strcmp(entry->d_name + length - 4, ".ppm")) continue;
+
+        if (fileCount == capacity) {
+            capacity *= 2;
+            files = realloc(files, capacity * sizeof(char*));
+        }
+        files[fileCount++] = strdup(entry->d_name);
+    }
+    closedir(dir);
+
+    qsort(files, fileCount, sizeof(char*), compareStrings);
+
+    uint32_t detected = 0;
+    uint32_t checked = 0;
+    uint32_t right = 0;
+    double totalMs = 0;
+
+    for (uint32_t f = 0; f < fileCount; f++) {
+        char image[strlen(path) + strlen(files[f]) + 2];
+        sprintf(image, "%s/%s", path, files[f]);
+
+        uint32_t *colors;
+        uint8_t *marks;
+        boardScreenInfo_t screenInfo;
+        double ms = 0;
+        const uint32_t size = detectImage(
+            image, &colors, &marks, &screenInfo, options, &ms
+        );
+        totalMs += ms;
+
+        // The board file next to it.
+        char expected[strlen(image) + 1];
+        strcpy(expected, image);
+        strcpy(expected + strlen(expected) - 4, ".txt");
+        const char *verdict = "";
+        if (access(expected, R_OK) == 0) {
+            checked++;
+            if (size && isRightBoard(expected, size, colors, screenInfo)) {
+                right++;
+                verdict = ", right";
+            }
+            else verdict = ", WRONG";
+        }
+
+        if (size) {
+            detected++;
+            printf("%s: %ux%u board at %u,%u (%u apart) in %.2f ms%s\n",
+                files[f], size, size, screenInfo.x, screenInfo.y,
+                screenInfo.offset, ms, verdict
+            );
+            free(colors);
+            free(marks);
+        }
+        else printf("%s: no board in %.2f ms%s\n", files[f], ms, verdict);
+
+        free(files[f]);
+    }
+    free(files);
+
+    printf("Found %u boards in %u screenshots (%u of %u right), "
+        "%.2f ms per screenshot.\n",
+        detected, fileCount, right, checked,
+        fileCount ? totalMs / fileCount : 0
+    );
+
+    return right == checked ? 0 : -1;
+}
+
+
+// Whether the board in the file has the same groups as colors,
+// and is in the same spot if the file says where it is.
+// The groups can have other numbers, as long as the same cells are in them.
+uint8_t isRightBoard(
+    const char *path, uint32_t size, uint32_t *colors,
+    boardScreenInfo_t screenInfo
+) {
+    FILE *file = fopen(path, "r");
+    corpus_t corpus;
+    if (file == NULL || openCorpus(file, &corpus)) {
+        fprintf(stderr, "Couldn't read %s.\n", path);
+        if (file) fclose(file);
+        return 0;
+    }
+    fclose(file);
+
+    puzzleView_t puzzle;
+    board_t board;
+    if (!nextPuzzle(&corpus, &puzzle) || readPuzzle(&puzzle, &board, NULL)) {
+        fprintf(stderr, "Couldn't read the board in %s.\n", path);
+        closeCorpus(&corpus);
+        return 0;
+    }
+
+    // Where the board really is (its ID), if it's there.
+    boardScreenInfo_t truth = {0};
+    if (puzzle.id) {
+        char id[puzzle.idLength + 1];
+        memcpy(id, puzzle.id, puzzle.idLength);
+        id[puzzle.idLength] = '\0';
+        sscanf(id, "geometry %u %u %u", &truth.x, &truth.y, &truth.offset);
+    }
+    closeCorpus(&corpus);
+
+    uint8_t same = board.size == size;
+    if (same) {
+        uint32_t expected[size * size];
+        uint32_t found[size * size];
+        for (uint32_t i = 0; i < size * size; i++) {
+            expected[i] = board.cells[i].color;
+            found[i] = colors[i];
+        }
+        renumberGroups(expected, size * size);
+        renumberGroups(found, size * size);
+        same = memcmp(expected, found, sizeof(expected)) == 0;
+    }
+    freeBoard(board);
+
+    if (same && truth.offset) {
+        const uint32_t tolerance = truth.offset / GEOMETRY_TOLERANCE;
+        same = abs((int32_t)screenInfo.x - (int32_t)truth.x) <= tolerance
+            && abs((int32_t)screenInfo.y - (int32_t)truth.y) <= tolerance
+            && abs((int32_t)screenInfo.offset - (int32_t)truth.offset) <= 1;
+    }
+
+    return same;
+}
+
+
+// Numbers the groups in the order they first show up.
+void renumberGroups(uint32_t *groups, uint32_t count) {
+    uint32_t numbers[count];
+    memset(numbers, 0xff, sizeof(numbers));
+
+    uint32_t next = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (groups[i] >= count) return;
+        if (numbers[groups[i]] == UINT32_MAX) numbers[groups[i]] = next++;
+        groups[i] = numbers[groups[i]];
+    }
+}
+
+
+int compareStrings(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
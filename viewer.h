@@ -0,0 +1,31 @@
+#ifndef VIEWER_H
+#define VIEWER_H
+
+#include <stdint.h>
+
+#include "seeer.h"
+
+
+// How far off (in 1/GEOMETRY_TOLERANCE of a cell) a detected board can be
+// from where it really is. Clicks still land well inside the cells.
+#define GEOMETRY_TOLERANCE 8
+
+// Detects the board in a screenshot stored as a PPM file,
+// the same way it would be on the screen.
+// Gives back the size like detectBoard, and how long it took (in ms).
+uint32_t detectImage(
+    const char *path, uint32_t **colors, uint8_t **marks,
+    boardScreenInfo_t *screenInfo, detectOptions_t *options, double *ms
+);
+
+// Detects the board in every PPM file in a directory, and prints how long
+// every one took. When there's a board file with the same name ending in .txt
+// (like game184.ppm and game184.txt), the detected board has to be that one.
+// If the board has a "# geometry X Y OFFSET" line before it (like
+// tools/render-board writes), it also has to be found in that spot
+// (see boardScreenInfo_t), give or take 1/GEOMETRY_TOLERANCE of a cell.
+// Returns 0 if every screenshot with a board file had the right board.
+int detectImageDir(const char *path, detectOptions_t *options);
+
+
+#endif // VIEWER_H